@@ -0,0 +1,39 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Sparse Match Count Accumulator
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <cstdlib>
+#include <cstring>
+#include "accu.h"
+
+CAccumulator :: CAccumulator ()
+  : m_count(NULL), m_touched(NULL), m_used(0), m_size(0)
+{
+}
+
+CAccumulator :: ~CAccumulator ()
+{
+  if (m_count)   free(m_count) ;
+  if (m_touched) free(m_touched) ;
+}
+
+void CAccumulator :: resize (UINT size)
+{
+  if (size <= m_size) return ;
+
+  m_count   = static_cast<UINT *>(realloc(m_count, size * sizeof(UINT))) ;
+  m_touched = static_cast<UINT *>(realloc(m_touched, size * sizeof(UINT))) ;
+  memset(&m_count[m_size], 0, (size - m_size) * sizeof(UINT)) ;
+  m_size = size ;
+}
+
+void CAccumulator :: clear (void)
+{
+  UINT k ;
+
+  for (k=0; k<m_used; k++) m_count[m_touched[k]] = 0 ;
+  m_used = 0 ;
+}
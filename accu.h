@@ -0,0 +1,48 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Sparse Match Count Accumulator
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _ACCU_H_
+#define _ACCU_H_
+
+#include "typedefs.h"
+
+// per-query match counters for all Q&A pairs
+// remembers which counters were touched, so that only these
+// need to be scored and reset for the next query
+
+class CAccumulator
+{
+public:
+  CAccumulator () ;
+  virtual ~CAccumulator () ;
+
+  // make room for (at least) size counters
+  void resize (UINT size) ;
+  // reset touched counters only
+  void clear (void) ;
+
+  void add (UINT index) {
+    if (m_count[index]++ == 0) m_touched[m_used++] = index ;
+  }
+  void add (UINT index, UINT inc) {
+    if (m_count[index] == 0) m_touched[m_used++] = index ;
+    m_count[index] += inc ;
+  }
+
+  UINT count (UINT index) const { return m_count[index]; }
+  UINT touched (UINT k) const { return m_touched[k]; }
+  UINT used (void) const { return m_used; }
+  UINT size (void) const { return m_size; }
+
+private:
+  UINT * m_count ;   // match counter per Q&A pair
+  UINT * m_touched ; // list of Q&A pairs with non-zero counter
+  UINT   m_used ;
+  UINT   m_size ;
+};
+
+#endif /* _ACCU_H_ */
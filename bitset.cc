@@ -0,0 +1,62 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Packed Bit Set
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include "bitset.h"
+
+CBitSet :: CBitSet ()
+  : m_size(0)
+{
+}
+
+CBitSet :: ~CBitSet ()
+{
+}
+
+void CBitSet :: resize (UINT size, bool value)
+{
+  UINT i, old = m_size ;
+
+  m_words.resize((size + BITSET_WORDBITS - 1) / BITSET_WORDBITS, 0UL) ;
+  m_size = size ;
+  if (size < old and size % BITSET_WORDBITS != 0) {
+    // clear bits beyond the new size
+    m_words.back() &= (1UL << (size % BITSET_WORDBITS)) - 1UL ;
+  }
+  if (value) {
+    for (i=old; i<size; i++) set(i) ;
+  }
+}
+
+void CBitSet :: push_back (bool value)
+{
+  if (m_size % BITSET_WORDBITS == 0) m_words.push_back(0UL) ;
+  m_size++ ;
+  if (value) set(m_size - 1) ;
+}
+
+void CBitSet :: intersect (const CBitSet & a, const CBitSet & b)
+{
+  UINT k, n, m ;
+
+  m_words.resize(a.m_words.size()) ;
+  m_size = a.m_size ;
+  n = a.m_words.size() ;
+  m = (b.m_words.size() < n) ? b.m_words.size() : n ;
+  for (k=0; k<m; k++) m_words[k] = a.m_words[k] & b.m_words[k] ;
+  for (; k<n; k++) m_words[k] = 0UL ;
+}
+
+UINT CBitSet :: count (void) const
+{
+  UINT k, c = 0 ;
+  ULONG w ;
+
+  for (k=0; k<m_words.size(); k++) {
+    for (w=m_words[k]; w != 0UL; w &= w - 1UL) c++ ;
+  }
+  return c ;
+}
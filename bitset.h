@@ -0,0 +1,56 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Packed Bit Set
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _BITSET_H_
+#define _BITSET_H_
+
+#include <vector>
+#include "typedefs.h"
+
+using namespace std;
+
+#define BITSET_WORDBITS (8 * sizeof(ULONG))
+
+// one bit per Q&A pair (e.g. usable or allowed for a query),
+// bits beyond the size are always zero
+
+class CBitSet
+{
+public:
+  CBitSet () ;
+  virtual ~CBitSet () ;
+
+  // change number of bits, new bits are set to value
+  void resize (UINT size, bool value = false) ;
+  void push_back (bool value) ;
+
+  void set (UINT index) {
+    m_words[index / BITSET_WORDBITS] |= (1UL << (index % BITSET_WORDBITS)) ;
+  }
+  void reset (UINT index) {
+    m_words[index / BITSET_WORDBITS] &= ~(1UL << (index % BITSET_WORDBITS)) ;
+  }
+  void assign (UINT index, bool value) {
+    if (value) set(index) ; else reset(index) ;
+  }
+  bool test (UINT index) const {
+    return (m_words[index / BITSET_WORDBITS] >> (index % BITSET_WORDBITS)) & 1UL ;
+  }
+
+  // a AND b word by word (missing bits of b count as zero),
+  // the result has the size of a
+  void intersect (const CBitSet & a, const CBitSet & b) ;
+
+  UINT size (void) const { return m_size; }
+  UINT count (void) const ;
+
+private:
+  vector<ULONG> m_words ;
+  UINT          m_size ;
+};
+
+#endif /* _BITSET_H_ */
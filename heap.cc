@@ -162,3 +162,97 @@ bool CMaxHeap <KeyType, DataType> :: front (DataType * data, KeyType * key)
     return true ;
   }
 }
+
+template <class KeyType, class DataType>
+CTopList <KeyType, DataType> :: CTopList (int size)
+{
+  m_size   = size ;
+  m_key    = new KeyType [m_size+1] ;
+  m_data   = new DataType [m_size+1] ;
+  m_used   = 0 ;
+}
+
+template <class KeyType, class DataType>
+CTopList <KeyType, DataType> :: ~CTopList ()
+{
+  if (m_key)  delete [] m_key ;
+  if (m_data) delete [] m_data ;
+}
+
+// move element k down to its place in the min-heap
+
+template <class KeyType, class DataType>
+void CTopList <KeyType, DataType> :: sift (int k)
+{
+  KeyType  key  = m_key[k] ;
+  DataType data = m_data[k] ;
+  int j ;
+
+  while ((j = 2*k) <= m_used) {
+    if (j+1 <= m_used and worse(m_key[j+1], m_data[j+1], m_key[j], m_data[j])) j++ ;
+    if (not worse(m_key[j], m_data[j], key, data)) break ;
+    m_key[k]  = m_key[j] ;
+    m_data[k] = m_data[j] ;
+    k = j ;
+  }
+
+  m_key[k]  = key ;
+  m_data[k] = data ;
+}
+
+template <class KeyType, class DataType>
+bool CTopList <KeyType, DataType> :: push (const KeyType & key, const DataType & data)
+{
+  int k ;
+
+  if (m_size < 1) return false ;
+
+  if (m_used < m_size) {
+    // list not yet full: insert as in min-heap
+    k = ++m_used ;
+    while (k > 1 and worse(key, data, m_key[k/2], m_data[k/2])) {
+      m_key[k]  = m_key[k/2] ;
+      m_data[k] = m_data[k/2] ;
+      k = k/2 ;
+    }
+    m_key[k]  = key ;
+    m_data[k] = data ;
+    return true ;
+  }
+
+  // list full: replace worst element if new one is better
+  if (not worse(m_key[1], m_data[1], key, data)) return false ;
+  m_key[1]  = key ;
+  m_data[1] = data ;
+  sift(1) ;
+
+  return true ;
+}
+
+template <class KeyType, class DataType>
+bool CTopList <KeyType, DataType> :: pop (DataType * data, KeyType * key)
+{
+  if (m_used == 0) return false ;
+
+  *data = m_data[1] ;
+  *key  = m_key[1] ;
+
+  m_key[1]  = m_key[m_used] ;
+  m_data[1] = m_data[m_used] ;
+  m_used -- ;
+  if (m_used > 0) sift(1) ;
+
+  return true ;
+}
+
+template <class KeyType, class DataType>
+bool CTopList <KeyType, DataType> :: front (DataType * data, KeyType * key)
+{
+  if (m_used == 0) {
+    return false ;
+  } else {
+    *data = m_data[1] ;
+    if (key != NULL) *key = m_key[1] ;
+    return true ;
+  }
+}
@@ -47,4 +47,34 @@ private:
   int        m_size ;
 };
 
+// bounded list of the size best (key,data) pairs
+// larger keys are better, equal keys prefer smaller data,
+// the worst pair kept so far is at the front
+
+template <class KeyType, class DataType>
+class CTopList
+{
+public:
+  CTopList (int size) ;
+  virtual ~CTopList () ;
+
+  bool push (const KeyType & key, const DataType & data) ;
+  bool pop (DataType * data, KeyType * key) ;
+  bool front (DataType * data, KeyType * key = NULL) ;
+  int  used (void) { return m_used; }
+  void clear (void) { m_used = 0; }
+
+private:
+  bool worse (const KeyType & k1, const DataType & d1,
+	      const KeyType & k2, const DataType & d2) {
+    return k1 < k2 or (k1 == k2 and d1 > d2) ;
+  }
+  void sift (int k) ;
+
+  KeyType  * m_key ;
+  DataType * m_data ;
+  int        m_used ;
+  int        m_size ;
+};
+
 #endif /* _HEAP_H_ */
@@ -0,0 +1,182 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Binary Image Files (compiled databases)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include "image.h"
+
+#define WORD_BYTES sizeof(UINT)
+
+CImageWriter :: CImageWriter (const char * file)
+  : m_file(file), m_temp(string(file) + ".tmp"),
+    m_out(m_temp.c_str(), ios::out | ios::binary | ios::trunc), m_size(0)
+{
+}
+
+void CImageWriter :: pad (void)
+{
+  static const char zeros[WORD_BYTES] = { 0 } ;
+
+  if (m_size % WORD_BYTES != 0) {
+    m_out.write(zeros, WORD_BYTES - m_size % WORD_BYTES);
+    m_size += WORD_BYTES - m_size % WORD_BYTES;
+  }
+}
+
+void CImageWriter :: put (UINT value)
+{
+  m_out.write(reinterpret_cast<const char *>(&value), WORD_BYTES);
+  m_size += WORD_BYTES;
+}
+
+void CImageWriter :: put (float value)
+{
+  UINT word ;
+
+  memcpy(&word, &value, WORD_BYTES);
+  put(word);
+}
+
+void CImageWriter :: put (const string & str)
+{
+  put(reinterpret_cast<const UBYTE *>(str.data()), static_cast<UINT>(str.size()));
+}
+
+void CImageWriter :: put (const UINT * data, UINT n)
+{
+  put(n);
+  if (n > 0) m_out.write(reinterpret_cast<const char *>(data), n * WORD_BYTES);
+  m_size += n * WORD_BYTES;
+}
+
+void CImageWriter :: put (const UBYTE * data, UINT n)
+{
+  put(n);
+  if (n > 0) m_out.write(reinterpret_cast<const char *>(data), n);
+  m_size += n;
+  pad();
+}
+
+// a new inode replaces the file, existing mappings are not touched
+
+bool CImageWriter :: close (void)
+{
+  m_out.close();
+  if (m_out.fail() or rename(m_temp.c_str(), m_file.c_str()) != 0) {
+    remove(m_temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+CImageReader :: CImageReader ()
+  : m_data(NULL), m_size(0), m_pos(0), m_good(false)
+{
+}
+
+bool CImageReader :: open (const char * file)
+{
+  struct stat st ;
+  void * addr ;
+  int fd ;
+
+  close();
+  fd = ::open(file, O_RDONLY);
+  if (fd < 0) return false;
+  if (fstat(fd, &st) != 0 or st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  // shared read-only mapping: pages are shared with other processes
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) return false;
+
+  m_data = static_cast<const char *>(addr);
+  m_size = st.st_size;
+  m_pos  = 0;
+  m_good = true;
+  return true;
+}
+
+void CImageReader :: close (void)
+{
+  if (m_data != NULL) munmap(const_cast<char *>(m_data), m_size);
+  m_data = NULL;
+  m_size = 0;
+  m_pos  = 0;
+  m_good = false;
+}
+
+// next bytes of the image (NULL if there are not enough left),
+// the read position stays word aligned
+
+const char * CImageReader :: need (ULONG bytes)
+{
+  const char * data ;
+  ULONG padded = (bytes + WORD_BYTES - 1) / WORD_BYTES * WORD_BYTES ;
+
+  if (not m_good or padded > m_size - m_pos) {
+    m_good = false;
+    return NULL;
+  }
+  data = m_data + m_pos;
+  m_pos += padded;
+  return data;
+}
+
+UINT CImageReader :: get_uint (void)
+{
+  const char * data = need(WORD_BYTES) ;
+
+  return (data != NULL) ? *reinterpret_cast<const UINT *>(data) : 0;
+}
+
+float CImageReader :: get_float (void)
+{
+  UINT word = get_uint() ;
+  float value ;
+
+  memcpy(&value, &word, WORD_BYTES);
+  return value;
+}
+
+string CImageReader :: get_string (void)
+{
+  const UBYTE * data ;
+  UINT n ;
+
+  data = get_bytes(n);
+  return (data != NULL) ? string(reinterpret_cast<const char *>(data), n) : string();
+}
+
+const UINT * CImageReader :: get_words (UINT & n)
+{
+  const char * data ;
+
+  n = get_uint();
+  if (n == 0) return NULL;
+  data = need(static_cast<ULONG>(n) * WORD_BYTES);
+  if (data == NULL) n = 0;
+  return reinterpret_cast<const UINT *>(data);
+}
+
+const UBYTE * CImageReader :: get_bytes (UINT & n)
+{
+  const char * data ;
+
+  n = get_uint();
+  if (n == 0) return NULL;
+  data = need(n);
+  if (data == NULL) n = 0;
+  return reinterpret_cast<const UBYTE *>(data);
+}
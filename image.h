@@ -0,0 +1,82 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Binary Image Files (compiled databases)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include "typedefs.h"
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+// an image is a sequence of 32-bit words in host byte order,
+// strings and byte arrays are padded to the next word boundary,
+// so that word arrays can be used in place when the image is mapped
+
+// the image is written to <file>.tmp and renamed to file by close(),
+// so that processes which have mapped the old file keep its contents
+
+class CImageWriter
+{
+public:
+  CImageWriter (const char * file) ;
+  virtual ~CImageWriter () {}
+
+  void put (UINT value) ;
+  void put (float value) ;
+  void put (const string & str) ;
+  // array length followed by the array
+  void put (const UINT * data, UINT n) ;
+  void put (const UBYTE * data, UINT n) ;
+
+  bool close (void) ;
+  bool good (void) const { return m_out.good(); }
+
+private:
+  void pad (void) ;
+
+  string   m_file ;
+  string   m_temp ;
+  ofstream m_out ;
+  ULONG    m_size ;  // bytes written
+};
+
+// read-only memory mapping of an image, arrays returned by
+// get_words() and get_bytes() stay valid until the image is closed.
+// reading past the end or a failed open clears good()
+
+class CImageReader
+{
+public:
+  CImageReader () ;
+  virtual ~CImageReader () { close(); }
+
+  bool open (const char * file) ;
+  void close (void) ;
+
+  UINT   get_uint (void) ;
+  float  get_float (void) ;
+  string get_string (void) ;
+  const UINT *  get_words (UINT & n) ;
+  const UBYTE * get_bytes (UINT & n) ;
+
+  bool  good (void) const { return m_good; }
+  ULONG size (void) const { return m_size; }
+
+private:
+  CImageReader (const CImageReader &) ;
+  CImageReader & operator= (const CImageReader &) ;
+  const char * need (ULONG bytes) ;
+
+  const char * m_data ;
+  ULONG        m_size ;
+  ULONG        m_pos ;
+  bool         m_good ;
+};
+
+#endif /* _IMAGE_H_ */
@@ -11,19 +11,21 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <iterator>
 #include <cmath>
 #include <iostream>
 
 #include "irt.h"
 
 template <class ElementType>
-void CTermVector <ElementType> :: add_term(ElementType term)
+void CTermVector <ElementType> :: add_term(ElementType term, UINT count)
 {
   if (find(m_keys.begin(),m_keys.end(), term) == m_keys.end()) {
     m_keys.push_back(term);
   }
-  m_data[term] += 1.0;
-  m_cnt++;
+  m_data[term] += static_cast<float>(count);
+  m_cnt += count;
 }
 
 template <class ElementType>
@@ -50,6 +52,23 @@ void CTermVector <ElementType> :: add_vector(CTermVector<ElementType> & tfvec)
   }
 }
 
+template <class ElementType>
+void CTermVector <ElementType> :: remove_termlist(vector<ElementType> & terms)
+{
+  typename vector<ElementType>::iterator it;
+  UINT i,k;
+
+  k = terms.size();
+  for (i=0; i<k; i++) {
+    m_data[terms[i]] -= 1.0;
+    m_cnt -= 1;
+    if (m_data[terms[i]] > 0.0) continue;
+    m_data.erase(terms[i]);
+    it = find(m_keys.begin(),m_keys.end(), terms[i]);
+    if (it != m_keys.end()) m_keys.erase(it);
+  }
+}
+
 template <class ElementType>
 void CTermVector <ElementType> :: print(void)
 {
@@ -115,6 +134,13 @@ float CTermVector <ElementType> :: operator[](ElementType & term)
   return m_data[term];
 }
 
+template <class ElementType>
+float CTermVector <ElementType> :: value(const ElementType & term) const
+{
+  typename map<ElementType,float>::const_iterator it = m_data.find(term);
+  return (it != m_data.end()) ? it->second : 0.0;
+}
+
 template <class ElementType>
 void CTermVector <ElementType> :: modify (ElementType & term, float value)
 {
@@ -124,7 +150,6 @@ void CTermVector <ElementType> :: modify (ElementType & term, float value)
 template <class ElementType>
 void CTermDocuMatrix <ElementType> :: add_document(CTermVector<ElementType> & tfvec, UINT ident)
 {
-  UINT i,d;
   if (find(m_ident.begin(),m_ident.end(), ident) == m_ident.end()) {
     m_ident.push_back(ident);
     m_matrix[ident] = tfvec;
@@ -134,6 +159,16 @@ void CTermDocuMatrix <ElementType> :: add_document(CTermVector<ElementType> & tf
   }
 }
 
+template <class ElementType>
+void CTermDocuMatrix <ElementType> :: del_documents(void)
+{
+  m_matrix.clear();
+  m_ident.clear();
+  m_df.clear();
+  m_docs.clear();
+  m_counter = 0;
+}
+
 template <class ElementType>
 void CTermDocuMatrix <ElementType> :: add_stoplist(vector<ElementType> & stoptermlist)
 {
@@ -195,6 +230,116 @@ UINT CTermDocuMatrix <ElementType> :: retrieve(CTermVector<ElementType> query, f
   return best;
 }
 
+template <class ElementType>
+UINT CTermDocuMatrix <ElementType> :: lookup(const vector<ElementType> & query,
+					     const vector<UINT> & weights, float * myscore) const
+{
+  UINT i;
+  UINT best = m_ident.front();
+  float maxscore = 0.0, score = 0.0;
+  CTermVector<ElementType> tfvec(m_simop);
+  typename map< UINT, CTermVector<ElementType> >::const_iterator it;
+
+  query_vector(query, weights, tfvec);
+
+  for (i=0; i<m_counter; i++) {
+    it = m_matrix.find(m_ident[i]);
+    score = similarity(it->second, tfvec);
+    if (score > maxscore) {
+      maxscore = score;
+      best = m_ident[i];
+    }
+  }
+
+  if (myscore != NULL) *myscore = maxscore;
+
+  return best;
+}
+
+template <class ElementType>
+void CTermDocuMatrix <ElementType> :: lookup_all(const vector<ElementType> & query,
+						 const vector<UINT> & weights,
+						 vector<UINT> & idents, vector<float> & scores) const
+{
+  UINT i;
+  CTermVector<ElementType> tfvec(m_simop);
+  typename map< UINT, CTermVector<ElementType> >::const_iterator it;
+
+  query_vector(query, weights, tfvec);
+
+  idents.resize(m_counter);
+  scores.resize(m_counter);
+  for (i=0; i<m_counter; i++) {
+    it = m_matrix.find(m_ident[i]);
+    idents[i] = m_ident[i];
+    scores[i] = similarity(it->second, tfvec);
+  }
+}
+
+// make normalized query vector with stop terms weighted zero
+
+template <class ElementType>
+void CTermDocuMatrix <ElementType> :: query_vector(const vector<ElementType> & query,
+						   const vector<UINT> & weights,
+						   CTermVector<ElementType> & tfvec) const
+{
+  UINT i,j,d,k;
+  ElementType term;
+
+  k = query.size();
+  for (i=0; i<k; i++) tfvec.add_term(query[i], weights.empty() ? 1 : weights[i]);
+
+  // apply stoplist to query vector
+  d = m_stoplist.size();
+  for (j=0; j<d; j++) {
+    term = m_stoplist[j];
+    tfvec.modify(term, 0.0);
+  }
+  tfvec.norm();
+}
+
+// similarity of document and query vector (cf. CTermVector::operator*)
+// stop terms of the document vector count as zero weights
+
+template <class ElementType>
+float CTermDocuMatrix <ElementType> :: similarity(const CTermVector<ElementType> & exvec,
+						  const CTermVector<ElementType> & query) const
+{
+  UINT i,k;
+  float v = 0.0, a = 0.0, b = 0.0, w, q;
+  ElementType term;
+
+  switch(exvec.m_simop) {
+  case SO_SCALAR:
+    k = query.m_keys.size();
+    for (i=0; i<k; i++) {
+      term = query.m_keys[i];
+      w = (find(m_stoplist.begin(),m_stoplist.end(),term) == m_stoplist.end()) ? exvec.value(term) : 0.0;
+      v += w * query.value(term);
+    }
+    break;
+  case SO_COSINUS:
+    k = query.m_keys.size();
+    for (i=0; i<k; i++) {
+      term = query.m_keys[i];
+      w = (find(m_stoplist.begin(),m_stoplist.end(),term) == m_stoplist.end()) ? exvec.value(term) : 0.0;
+      q = query.value(term);
+      v += w * q;
+      a += q * q;
+    }
+    k = exvec.m_keys.size();
+    for (i=0; i<k; i++) {
+      term = exvec.m_keys[i];
+      w = (find(m_stoplist.begin(),m_stoplist.end(),term) == m_stoplist.end()) ? exvec.value(term) : 0.0;
+      b += w * w;
+    }
+    v = v/sqrt(a*b);
+    break;
+  }
+
+  return v;
+}
+
 template <class ElementType>
 CTermVector <ElementType> & CTermDocuMatrix <ElementType> :: operator[](UINT ident)
 {
@@ -209,9 +354,13 @@ void CTermDocuMatrix <ElementType> :: to_tfidf(void)
   UINT i,j,m;
   
   // determine document frequency for each term
+  m_df.clear();
+  m_docs.clear();
   for (i=0; i<m_counter; i++) {
     terms = m_matrix[m_ident[i]].termlist();
     idf.add_termlist(terms);
+    m = terms.size();
+    for (j=0; j<m; j++) m_docs[terms[j]].push_back(m_ident[i]);
   }
 
   // df -> idf
@@ -219,7 +368,8 @@ void CTermDocuMatrix <ElementType> :: to_tfidf(void)
   m = terms.size();
   for (j=0; j<m; j++) {
     if (idf.m_data[terms[j]] > 0.0) {
-      idf.m_data[terms[j]] = log(static_cast<float>(m_counter)/idf[terms[j]])+1.0;
+      m_df[terms[j]] = static_cast<UINT>(idf[terms[j]]);
+      idf.m_data[terms[j]] = idf_weight(m_df[terms[j]]);
     } else {
       idf.m_data[terms[j]] = 1.0;
     }
@@ -235,3 +385,70 @@ void CTermDocuMatrix <ElementType> :: to_tfidf(void)
     }
   }
 }
+
+template <class ElementType>
+float CTermDocuMatrix <ElementType> :: idf_weight(UINT df) const
+{
+  return log(static_cast<float>(m_counter)/static_cast<float>(df))+1.0;
+}
+
+// terms entering or leaving the document change their document
+// frequency, and with it the rows of all documents containing them
+
+template <class ElementType>
+void CTermDocuMatrix <ElementType> :: update_document(CTermVector<ElementType> & tfvec,
+						      UINT ident, vector<UINT> & stale)
+{
+  vector<ElementType> oldterms, newterms, changed;
+  typename vector<UINT>::iterator it;
+  UINT i,j,m;
+
+  oldterms = m_matrix[ident].termlist();
+  newterms = tfvec.termlist();
+  sort(oldterms.begin(), oldterms.end());
+  sort(newterms.begin(), newterms.end());
+  set_symmetric_difference(oldterms.begin(), oldterms.end(),
+			   newterms.begin(), newterms.end(), back_inserter(changed));
+
+  stale.assign(1, ident);
+  m = changed.size();
+  for (j=0; j<m; j++) {
+    vector<UINT> & docs = m_docs[changed[j]];
+    if (binary_search(newterms.begin(), newterms.end(), changed[j])) {
+      m_df[changed[j]] += 1;
+      docs.push_back(ident);
+    } else {
+      m_df[changed[j]] -= 1;
+      it = find(docs.begin(), docs.end(), ident);
+      if (it != docs.end()) docs.erase(it);
+    }
+    for (i=0; i<docs.size(); i++) stale.push_back(docs[i]);
+    if (m_df[changed[j]] == 0) {
+      m_df.erase(changed[j]);
+      m_docs.erase(changed[j]);
+    }
+  }
+  sort(stale.begin(), stale.end());
+  stale.erase(unique(stale.begin(), stale.end()), stale.end());
+}
+
+template <class ElementType>
+void CTermDocuMatrix <ElementType> :: reweight_document(CTermVector<ElementType> & tfvec,
+							UINT ident)
+{
+  CTermVector<ElementType> & row = m_matrix[ident];
+  typename map<ElementType,UINT>::const_iterator it;
+  vector<ElementType> terms;
+  UINT j,m;
+  float idf;
+
+  row = tfvec;
+  row.norm();
+  terms = row.termlist();
+  m = terms.size();
+  for (j=0; j<m; j++) {
+    it = m_df.find(terms[j]);
+    idf = (it != m_df.end()) ? idf_weight(it->second) : 1.0;
+    row.m_data[terms[j]] *= idf;
+  }
+}
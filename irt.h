@@ -28,14 +28,18 @@ template <class ElementType>
 class CTermVector
 {
   friend void CTermDocuMatrix<ElementType> :: to_tfidf(void);
+  friend class CTermDocuMatrix<ElementType>;
 public:
-  CTermVector(SimOp op) : m_simop(op), m_cnt(0) {}
-  CTermVector() : m_simop(SO_SCALAR), m_cnt(0) {}
+  CTermVector(SimOp op) : m_cnt(0), m_simop(op) {}
+  CTermVector() : m_cnt(0), m_simop(SO_SCALAR) {}
   virtual ~CTermVector() {}
 
-  void add_term(ElementType term) ;
+  // term occurring count times
+  void add_term(ElementType term, UINT count = 1) ;
   void add_termlist(vector<ElementType> & termlist) ;
   void add_vector(CTermVector<ElementType> & vec) ;
+  // each term occurring once less (terms with count zero are dropped)
+  void remove_termlist(vector<ElementType> & termlist) ;
 
   void norm(void);
   void print(void);
@@ -44,6 +48,7 @@ public:
 
   float operator*(CTermVector<ElementType> & vec) ;
   float operator[](ElementType & term) ;
+  float value(const ElementType & term) const ;
   void  modify(ElementType & term, float value) ;
 
 private:
@@ -65,21 +70,43 @@ public:
   void del_stoplist(void);
 
   void add_document(CTermVector<ElementType> & tfvec, UINT ident);
+  void del_documents(void);
 
   UINT retrieve(vector<ElementType> query, float * myscore = NULL);
   UINT retrieve(CTermVector<ElementType> query, float * myscore = NULL);
+  // same as retrieve(), but without modifying the matrix,
+  // query term i occurs weights[i] times (weights empty: once)
+  UINT lookup(const vector<ElementType> & query, const vector<UINT> & weights,
+	      float * myscore = NULL) const;
+  // similarity scores of all documents (in order of insertion)
+  void lookup_all(const vector<ElementType> & query, const vector<UINT> & weights,
+		  vector<UINT> & idents, vector<float> & scores) const;
 
   CTermVector<ElementType> & operator[](UINT ident);
 
   void to_tfidf(void);
+  // new tf-vector of a document of the tf-idf matrix (same documents),
+  // stale gets the documents whose row has to be reweighted
+  void update_document(CTermVector<ElementType> & tfvec, UINT ident, vector<UINT> & stale);
+  // tf-idf row of a document from its tf-vector (as to_tfidf)
+  void reweight_document(CTermVector<ElementType> & tfvec, UINT ident);
   void print_matrix(void);
 
 private:
+  float idf_weight(UINT df) const;
+  void query_vector(const vector<ElementType> & query, const vector<UINT> & weights,
+		    CTermVector<ElementType> & tfvec) const;
+  float similarity(const CTermVector<ElementType> & exvec,
+		   const CTermVector<ElementType> & query) const;
+
   map< UINT, CTermVector<ElementType> > m_matrix;
   vector< UINT >                        m_ident;
   vector< ElementType >                 m_stoplist;
   UINT                                  m_counter; // # of documents
   SimOp                                 m_simop;
+  // document frequency and documents of each term (set by to_tfidf)
+  map< ElementType, UINT >              m_df;
+  map< ElementType, vector<UINT> >      m_docs;
 };
 
 #endif /* _IRT_H_ */
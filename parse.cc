@@ -1,19 +1,130 @@
 
 #include "parse.h"
 #include <iostream>
+#include <pthread.h>
+#include <map>
+#include <list>
 
 extern int debug;
 
+// chasen keeps a single global analyzer instance,
+// so concurrent callers have to take turns
+static pthread_mutex_t chasen_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// memoized analysis results, least recently used entry at the back
+typedef list< pair<string,Sentence> > ParseList;
+
+static pthread_mutex_t parse_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ParseList parse_list;
+static map< string, ParseList::iterator > parse_lookup;
+static ULONG parse_maxbytes = 0;
+static ULONG parse_bytes = 0;
+static ULONG parse_hits = 0;
+static ULONG parse_misses = 0;
+
+// morpheme separator of pre-tokenized input (0: chasen)
+static char parse_separator = 0;
+
+static Sentence analyze_sentence(const char * input);
+static Sentence split_sentence(const char * input);
+
+// approximate memory used by a cache entry
+
+static ULONG entry_size(const string & input, const Sentence & sent)
+{
+  ULONG size = 2 * input.size() + sizeof(ParseList::value_type) + 64;
+  UINT i;
+
+  for (i=0; i<sent.size(); i++) {
+    size += sizeof(Morpheme) + sent[i].m_origin.size();
+    size += sent[i].m_yomi.size() + sent[i].m_basis.size();
+  }
+  return size;
+}
+
+// drop least recently used entries (mutex held)
+
+static void shrink_cache(ULONG maxbytes)
+{
+  while (parse_bytes > maxbytes and parse_list.size() > 0) {
+    parse_bytes -= entry_size(parse_list.back().first, parse_list.back().second);
+    parse_lookup.erase(parse_list.back().first);
+    parse_list.pop_back();
+  }
+}
+
+void parse_cache(ULONG maxbytes)
+{
+  pthread_mutex_lock(&parse_mutex);
+  parse_maxbytes = maxbytes;
+  shrink_cache(maxbytes);
+  pthread_mutex_unlock(&parse_mutex);
+}
+
+void parse_cachestats(ULONG & hits, ULONG & misses)
+{
+  pthread_mutex_lock(&parse_mutex);
+  hits = parse_hits;
+  misses = parse_misses;
+  pthread_mutex_unlock(&parse_mutex);
+}
+
+void parse_pretokenized(char separator)
+{
+  parse_separator = separator;
+}
+
 void parse_init(const char * cfgfile)
 {
   const char * argv[] = {"-r", cfgfile, NULL};
   chasen_getopt_argv((char **)argv, stdin);
 }
 
+// morphological analysis, answered from the cache if possible
+// (no memoization in chasen debug mode, which prints the analysis)
+
 Sentence parse_sentence(const char * input)
 {
-  static int i, n;
+  map< string, ParseList::iterator >::iterator it;
+  string key(input);
+  Sentence sent;
+  ULONG size;
+
+  if (parse_separator != 0) return split_sentence(input);
+  if (parse_maxbytes == 0 or debug == 1) return analyze_sentence(input);
+
+  pthread_mutex_lock(&parse_mutex);
+  it = parse_lookup.find(key);
+  if (it != parse_lookup.end()) {
+    parse_list.splice(parse_list.begin(), parse_list, it->second);
+    sent = it->second->second;
+    parse_hits++;
+    pthread_mutex_unlock(&parse_mutex);
+    return sent;
+  }
+  parse_misses++;
+  pthread_mutex_unlock(&parse_mutex);
+
+  sent = analyze_sentence(input);
+
+  pthread_mutex_lock(&parse_mutex);
+  size = entry_size(key, sent);
+  if (size <= parse_maxbytes and parse_lookup.find(key) == parse_lookup.end()) {
+    shrink_cache(parse_maxbytes - size);
+    parse_list.push_front(make_pair(key, sent));
+    parse_lookup[key] = parse_list.begin();
+    parse_bytes += size;
+  }
+  pthread_mutex_unlock(&parse_mutex);
+
+  return sent;
+}
+
+static Sentence analyze_sentence(const char * input)
+{
+  int i, n = 0;
   char * buffer;
+  string text;
   Morpheme morph;
   vector<string> lines;
   vector<string> tokens;
@@ -22,10 +133,14 @@ Sentence parse_sentence(const char * input)
   string token;
   Sentence sent;
   
+  // copy result out of the analyzer buffer before releasing it
+  pthread_mutex_lock(&chasen_mutex);
   buffer = chasen_sparse_tostr((char *)input);
+  if (buffer != NULL) text.assign(buffer);
+  pthread_mutex_unlock(&chasen_mutex);
 
   if (buffer != NULL) {
-    lines = split(buffer, '\n');
+    lines = split(text.c_str(), '\n');
     n = lines.size();
   }
 
@@ -71,3 +186,27 @@ Sentence parse_sentence(const char * input)
   return sent;
 }
 
+// pre-tokenized input: the tokens are taken as morphemes
+// of unknown part of speech
+
+static Sentence split_sentence(const char * input)
+{
+  vector<string> tokens;
+  Morpheme morph;
+  Sentence sent;
+  UINT i;
+
+  morph.m_poscode  = 0;
+  morph.m_conjform = 0;
+  morph.m_conjtype = 0;
+  tokens = split(input, parse_separator);
+  for (i=0; i<tokens.size(); i++) {
+    if (tokens[i].empty()) continue;
+    morph.m_origin = tokens[i];
+    morph.m_yomi   = tokens[i];
+    morph.m_basis  = tokens[i];
+    sent.push_back(morph);
+  }
+
+  return sent;
+}
@@ -19,7 +19,15 @@ typedef struct
 typedef vector<Morpheme> Sentence;
 
 void parse_init(const char * cfgfile);
+// input is already segmented into morphemes by separator,
+// chasen is not used (0: analyze with chasen)
+void parse_pretokenized(char separator);
 
 Sentence parse_sentence(const char * input);
 
+// memoize analysis results using up to about maxbytes of memory
+// (0: no memoization), the cache is shared by all threads
+void parse_cache(ULONG maxbytes);
+void parse_cachestats(ULONG & hits, ULONG & misses);
+
 #endif /* _PARSE_H_ */
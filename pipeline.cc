@@ -0,0 +1,159 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Query Pipeline (reader, analysis, scoring and writer stages)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <cstring>
+#include "pipeline.h"
+#include "ring.cc"
+
+QAPipeline :: QAPipeline (QAHandle * handle, LoadOptions * opts,
+			  int parsers, int scorers, int nbest)
+  : m_handle(handle), m_opts(opts),
+    m_parsers(parsers > 1 ? parsers : 1), m_scorers(scorers > 1 ? scorers : 1),
+    m_nbest(nbest), m_in(NULL), m_items(PIPELEN),
+    // room for all items and the end markers
+    m_free(PIPELEN), m_lines(PIPELEN + m_parsers), m_parsed(PIPELEN + m_scorers),
+    m_scored(PIPELEN + 1), m_parsing(0), m_scoring(0)
+{
+  UINT i;
+
+  for (i=0; i<m_items.size(); i++) m_free.push(&m_items[i]);
+}
+
+QAPipeline :: ~QAPipeline ()
+{
+}
+
+UINT QAPipeline :: run (istream * in, ostream * out)
+{
+  vector<pthread_t> threads(1 + m_parsers + m_scorers);
+  UINT i, n;
+  int t;
+
+  m_in      = in;
+  m_parsing = m_parsers;
+  m_scoring = m_scorers;
+
+  pthread_create(&threads[0], NULL, reader, this);
+  for (t=0; t<m_parsers; t++) pthread_create(&threads[1+t], NULL, parser, this);
+  for (t=0; t<m_scorers; t++) pthread_create(&threads[1+m_parsers+t], NULL, scorer, this);
+  n = write(out);
+  for (i=0; i<threads.size(); i++) pthread_join(threads[i], NULL);
+
+  return n;
+}
+
+// read queries, reloads are started from here (single thread)
+
+void * QAPipeline :: reader (void * arg)
+{
+  QAPipeline * pipe = static_cast<QAPipeline *>(arg);
+  char input[MAXINLEN+1];
+  QAItem * item;
+  UINT seq = 0;
+  int t;
+
+  while (!pipe->m_in->eof()) {
+    pipe->m_in->getline(&input[0], MAXINLEN);
+    if (strlen(&input[0]) == 0) continue;
+    check_signals(pipe->m_handle, *pipe->m_opts);
+    pipe->m_free.get(item);
+    item->m_seq   = seq++;
+    item->m_input = &input[0];
+    pipe->m_lines.put(item);
+  }
+  for (t=0; t<pipe->m_parsers; t++) pipe->m_lines.put(NULL);
+
+  return NULL;
+}
+
+// morphological analysis, the database is held until the query is scored
+
+void * QAPipeline :: parser (void * arg)
+{
+  QAPipeline * pipe = static_cast<QAPipeline *>(arg);
+  QAItem * item;
+  int t;
+
+  while (true) {
+    pipe->m_lines.get(item);
+    if (item == NULL) break;
+    item->m_db = pipe->m_handle->acquire();
+    item->m_db->parse_query(item->m_input.c_str(), item->m_query);
+    pipe->m_parsed.put(item);
+  }
+  // the last parser ends the scoring stage
+  if (__sync_sub_and_fetch(&pipe->m_parsing, 1) == 0)
+    for (t=0; t<pipe->m_scorers; t++) pipe->m_parsed.put(NULL);
+
+  return NULL;
+}
+
+void * QAPipeline :: scorer (void * arg)
+{
+  QAPipeline * pipe = static_cast<QAPipeline *>(arg);
+  QAContext  context;
+  QAResult   result;
+  vector<QAResult> results;
+  QAItem * item;
+  ULONG start;
+
+  while (true) {
+    pipe->m_parsed.get(item);
+    if (item == NULL) break;
+    if (pipe->m_nbest > 0) {
+      item->m_db->retrieve_nbest(item->m_query, pipe->m_nbest, true, context, results);
+      start = timing_start();
+      item->m_answer = format_nbest(results);
+    } else {
+      result = item->m_db->retrieve(item->m_query, context);
+      start = timing_start();
+      item->m_answer = format_result(item->m_db, result, item->m_input.c_str());
+    }
+    item->m_outtime = timing_since(start);
+    pipe->m_handle->release(item->m_db);
+    item->m_db = NULL;
+    pipe->m_scored.put(item);
+  }
+  if (__sync_sub_and_fetch(&pipe->m_scoring, 1) == 0)
+    pipe->m_scored.put(NULL);
+
+  return NULL;
+}
+
+// write answers in input order, the output is flushed
+// only when the writer has to wait for the next answer
+
+UINT QAPipeline :: write (ostream * out)
+{
+  vector<QAItem *> pending(m_items.size(), static_cast<QAItem *>(NULL));
+  QAItem * item;
+  UINT next = 0, k = m_items.size();
+  ULONG start;
+
+  while (true) {
+    if (not m_scored.pop(item)) {
+      out->flush();
+      m_scored.get(item);
+    }
+    if (item == NULL) break;
+    // at most k items are in flight, so their slots differ
+    pending[item->m_seq % k] = item;
+    while ((item = pending[next % k]) != NULL) {
+      start = timing_start();
+      *out << item->m_answer << "\n";
+      if (start != 0) timing_add(TIME_OUTPUT, item->m_outtime + timing_since(start));
+      pending[next % k] = NULL;
+      next++;
+      indicator(next,100);
+      m_free.put(item);
+    }
+  }
+  out->flush();
+
+  return next;
+}
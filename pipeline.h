@@ -0,0 +1,69 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Query Pipeline (reader, analysis, scoring and writer stages)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "qadbman.h"
+#include "ring.h"
+
+using namespace std;
+
+// query on its way through the pipeline
+typedef struct {
+  UINT    m_seq;     // input line number
+  string  m_input;
+  QAQuery m_query;   // morpheme codes of m_db
+  QADB *  m_db;      // database used for analysis and scoring
+  string  m_answer;
+  ULONG   m_outtime; // formatting time of m_answer (timing)
+} QAItem;
+
+class QAPipeline
+{
+public:
+  // parsers threads for morphological analysis, scorers threads for retrieval,
+  // opts is used for reloading
+  QAPipeline (QAHandle * handle, LoadOptions * opts, int parsers, int scorers, int nbest) ;
+  virtual ~QAPipeline () ;
+
+  // answer all queries of in, the answers are written in input order,
+  // returns the number of queries
+  UINT run (istream * in, ostream * out) ;
+
+private:
+  QAPipeline (const QAPipeline &) ;
+  QAPipeline & operator= (const QAPipeline &) ;
+
+  static void * reader (void * arg) ;
+  static void * parser (void * arg) ;
+  static void * scorer (void * arg) ;
+  UINT write (ostream * out) ;
+
+  QAHandle *       m_handle ;
+  LoadOptions *    m_opts ;
+  int              m_parsers ;
+  int              m_scorers ;
+  int              m_nbest ;     // n-best output if > 0
+  istream *        m_in ;
+
+  // all items, in flight or in m_free (bounds the reorder buffer)
+  vector<QAItem>   m_items ;
+  // queues between the stages, NULL ends a stage
+  CRing<QAItem *>  m_free ;
+  CRing<QAItem *>  m_lines ;
+  CRing<QAItem *>  m_parsed ;
+  CRing<QAItem *>  m_scored ;
+  // threads still running in the analysis and scoring stage
+  UINT             m_parsing ;
+  UINT             m_scoring ;
+};
+
+#endif /* _PIPELINE_H_ */
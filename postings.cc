@@ -0,0 +1,265 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Inverted Index (Compressed Sparse Row Layout)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <algorithm>
+#include "postings.h"
+
+// work share of one thread during index construction
+
+typedef struct {
+  const vector< const vector<UINT> * > * m_docs;
+  UINT   m_first;   // first document of this share
+  UINT   m_last;    // one past the last document
+  UINT * m_count;   // term counter, later write cursor per term
+  UINT * m_postings;
+  int    m_pass;
+} IndexShare;
+
+static void * index_worker (void * arg)
+{
+  IndexShare * share = static_cast<IndexShare *>(arg);
+  const vector<UINT> * terms;
+  UINT i, k, m;
+
+  for (i=share->m_first; i<share->m_last; i++) {
+    terms = (*share->m_docs)[i];
+    if (terms == NULL) continue;
+    m = terms->size();
+    if (share->m_pass == 1) {
+      // first pass: count postings per term
+      for (k=0; k<m; k++) share->m_count[(*terms)[k]]++;
+    } else {
+      // second pass: scatter document index into postings lists
+      for (k=0; k<m; k++) share->m_postings[share->m_count[(*terms)[k]]++] = i;
+    }
+  }
+
+  return NULL;
+}
+
+static void run_shares (vector<IndexShare> & shares, int pass)
+{
+  vector<pthread_t> threads(shares.size());
+  UINT t, n = shares.size();
+
+  for (t=0; t<n; t++) shares[t].m_pass = pass;
+  if (n == 1) {
+    index_worker(&shares[0]);
+    return;
+  }
+  for (t=0; t<n; t++) pthread_create(&threads[t], NULL, index_worker, &shares[t]);
+  for (t=0; t<n; t++) pthread_join(threads[t], NULL);
+}
+
+CPostingIndex :: CPostingIndex ()
+  : m_nterms(0), m_compressed(false)
+{
+  clear();
+}
+
+void CPostingIndex :: clear (void)
+{
+  m_offset.assign(1, 0);
+  m_postings.clear();
+  m_boffset.assign(1, 0);
+  m_bytes.clear();
+  m_nterms = 0;
+  bind();
+}
+
+// use the member vectors
+
+void CPostingIndex :: bind (void)
+{
+  m_off  = &m_offset[0];
+  m_post = (m_postings.size() > 0) ? &m_postings[0] : NULL;
+  m_boff = &m_boffset[0];
+  m_code = (m_bytes.size() > 0) ? &m_bytes[0] : NULL;
+}
+
+void CPostingIndex :: set_compressed (bool on)
+{
+  if (on == m_compressed) return;
+  if (on) {
+    encode();
+  } else {
+    expand();
+  }
+  m_compressed = on;
+}
+
+ULONG CPostingIndex :: bytes (void) const
+{
+  ULONG words = 2 * (m_nterms + 1) ;
+
+  if (m_compressed) return words * sizeof(UINT) + m_boff[m_nterms];
+  return (words + m_off[m_nterms]) * sizeof(UINT);
+}
+
+// plain -> compressed layout, the plain postings are released
+
+void CPostingIndex :: encode (void)
+{
+  vector<UINT> empty;
+  UINT t, k, prev, gap;
+
+  if (m_off != &m_offset[0]) m_offset.assign(m_off, m_off + m_nterms + 1);
+  m_bytes.clear();
+  m_boffset.assign(m_nterms + 1, 0);
+  for (t=0; t<m_nterms; t++) {
+    m_boffset[t] = m_bytes.size();
+    for (prev=0, k=m_offset[t]; k<m_offset[t+1]; k++) {
+      gap  = m_post[k] - prev;
+      prev = m_post[k];
+      while (gap >= 0x80) {
+	m_bytes.push_back(UBYTE(gap | 0x80));
+	gap >>= 7;
+      }
+      m_bytes.push_back(UBYTE(gap));
+    }
+  }
+  m_boffset[m_nterms] = m_bytes.size();
+  m_postings.swap(empty);
+  bind();
+}
+
+// compressed -> plain layout
+
+void CPostingIndex :: expand (void)
+{
+  vector<UBYTE> empty;
+  vector<UINT> buffer;
+  const UINT * list;
+  UINT t;
+
+  if (m_off != &m_offset[0]) m_offset.assign(m_off, m_off + m_nterms + 1);
+  m_postings.assign(m_offset[m_nterms], 0);
+  for (t=0; t<m_nterms; t++) {
+    list = decode(t, buffer);
+    if (list != NULL) copy(list, list + size(t), m_postings.begin() + m_offset[t]);
+  }
+  m_boffset.assign(1, 0);
+  m_bytes.swap(empty);
+  bind();
+}
+
+const UINT * CPostingIndex :: decode (UINT term, vector<UINT> & buffer) const
+{
+  const UBYTE * code;
+  UINT k, m, val, doc, shift;
+
+  m = size(term);
+  if (m == 0) return NULL;
+  if (buffer.size() < m) buffer.resize(m);
+  code = m_code + m_boff[term];
+  for (doc=0, k=0; k<m; k++) {
+    for (val=0, shift=0; *code & 0x80; shift+=7) val |= (*code++ & 0x7f) << shift;
+    val |= static_cast<UINT>(*code++) << shift;
+    doc += val;
+    buffer[k] = doc;
+  }
+
+  return &buffer[0];
+}
+
+// image layout: number of terms, layout flag, list offsets,
+// then either the documents or the compressed list offsets and codes
+
+void CPostingIndex :: save (CImageWriter & image) const
+{
+  image.put(m_nterms);
+  image.put(static_cast<UINT>(m_compressed ? 1 : 0));
+  image.put(m_off, m_nterms + 1);
+  if (m_compressed) {
+    image.put(m_boff, m_nterms + 1);
+    image.put(m_code, m_boff[m_nterms]);
+  } else {
+    image.put(m_post, m_off[m_nterms]);
+  }
+}
+
+bool CPostingIndex :: attach (CImageReader & image)
+{
+  const UINT * off;
+  const UINT * post = NULL;
+  const UINT * boff = NULL;
+  const UBYTE * code = NULL;
+  UINT nterms, n, m = 0;
+  bool compressed;
+
+  nterms     = image.get_uint();
+  compressed = (image.get_uint() != 0);
+  off = image.get_words(n);
+  if (not image.good() or off == NULL or n != nterms + 1) return false;
+  if (compressed) {
+    boff = image.get_words(n);
+    if (boff == NULL or n != nterms + 1) return false;
+    code = image.get_bytes(m);
+    if (m != boff[nterms]) return false;
+  } else {
+    post = image.get_words(m);
+    if (m != off[nterms]) return false;
+  }
+  if (not image.good()) return false;
+
+  // drop own arrays, use those of the image
+  clear();
+  m_nterms     = nterms;
+  m_compressed = compressed;
+  m_off  = off;
+  m_post = post;
+  m_boff = compressed ? boff : &m_boffset[0];
+  m_code = code;
+  return true;
+}
+
+void CPostingIndex :: build (const vector< const vector<UINT> * > & docs,
+			     UINT maxterm, int nthreads)
+{
+  vector<IndexShare> shares;
+  vector<UINT> counts;
+  UINT i, t, n, m, nt, sum, cnt;
+
+  n  = docs.size();
+  m  = maxterm + 1;
+  nt = (nthreads < 1) ? 1 : static_cast<UINT>(nthreads);
+  // do not bother threads with tiny shares
+  if (nt > 1 and n < 1024 * nt) nt = (n / 1024 > 1) ? n / 1024 : 1;
+
+  // documents are split into consecutive shares, one per thread,
+  // so that each postings list is sorted by document index
+  counts.assign(static_cast<size_t>(nt) * m, 0);
+  shares.resize(nt);
+  for (t=0; t<nt; t++) {
+    shares[t].m_docs  = &docs;
+    shares[t].m_first = static_cast<UINT>((static_cast<ULONG>(n) * t) / nt);
+    shares[t].m_last  = static_cast<UINT>((static_cast<ULONG>(n) * (t+1)) / nt);
+    shares[t].m_count = &counts[static_cast<size_t>(t) * m];
+  }
+  run_shares(shares, 1);
+
+  // prefix sums: list offsets per term, write cursors per share
+  m_offset.assign(m+1, 0);
+  for (sum=0, i=0; i<m; i++) {
+    m_offset[i] = sum;
+    for (t=0; t<nt; t++) {
+      cnt = shares[t].m_count[i];
+      shares[t].m_count[i] = sum;
+      sum += cnt;
+    }
+  }
+  m_offset[m] = sum;
+  m_nterms = m;
+
+  m_postings.assign(sum, 0);
+  for (t=0; t<nt; t++) shares[t].m_postings = (sum > 0) ? &m_postings[0] : NULL;
+  run_shares(shares, 2);
+
+  bind();
+  if (m_compressed) encode();
+}
@@ -0,0 +1,83 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Inverted Index (Compressed Sparse Row Layout)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _POSTINGS_H_
+#define _POSTINGS_H_
+
+#include "typedefs.h"
+#include "image.h"
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// mapping from term code to the sorted list of documents containing it
+// all postings lists are stored back to back in one array,
+// the list of term t is m_postings[m_offset[t] .. m_offset[t+1]-1]
+// compressed layout: each list is stored as variable-length byte codes
+// of the gaps between consecutive documents (7 bits per byte, high bit
+// set on all but the last byte of a code), m_bytes[m_boffset[t] ..]
+// the arrays are accessed through pointers, which refer either to the
+// member vectors or to a memory-mapped image (see attach)
+
+class CPostingIndex
+{
+public:
+  CPostingIndex () ;
+  virtual ~CPostingIndex () {}
+
+  // build index from one term list per document
+  // (NULL for documents to be left out), terms must be <= maxterm
+  void build (const vector< const vector<UINT> * > & docs,
+	      UINT maxterm, int nthreads = 1) ;
+  void clear (void) ;
+  // switch between plain and compressed layout (keeps the postings)
+  void set_compressed (bool on) ;
+  bool compressed (void) const { return m_compressed; }
+
+  // write index into image, or use the index stored in a mapped
+  // image in place (the image must stay open while the index is used)
+  void save (CImageWriter & image) const ;
+  bool attach (CImageReader & image) ;
+
+  // number of documents containing term
+  UINT size (UINT term) const {
+    return (term < m_nterms) ? m_off[term+1] - m_off[term] : 0 ;
+  }
+  // postings list of term (plain layout only)
+  const UINT * list (UINT term) const {
+    return (term < m_nterms and m_post != NULL) ? m_post + m_off[term] : NULL ;
+  }
+  // postings list of term, compressed lists are decoded into buffer
+  const UINT * list (UINT term, vector<UINT> & buffer) const {
+    return m_compressed ? decode(term, buffer) : list(term) ;
+  }
+
+  UINT terms (void) const { return m_nterms; }
+  UINT postings (void) const { return m_off[m_nterms]; }
+  // memory used by the postings lists and offsets
+  ULONG bytes (void) const ;
+
+private:
+  const UINT * decode (UINT term, vector<UINT> & buffer) const ;
+  void encode (void) ;
+  void expand (void) ;
+  void bind (void) ;
+
+  vector<UINT>  m_offset ;   // start of postings list per term
+  vector<UINT>  m_postings ; // document indices of all postings lists
+  vector<UINT>  m_boffset ;  // start of compressed list per term
+  vector<UBYTE> m_bytes ;    // gap codes of all postings lists
+  const UINT *  m_off ;      // arrays in use
+  const UINT *  m_post ;
+  const UINT *  m_boff ;
+  const UBYTE * m_code ;
+  UINT          m_nterms ;
+  bool          m_compressed ;
+};
+
+#endif /* _POSTINGS_H_ */
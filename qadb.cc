@@ -19,12 +19,106 @@ extern int debug;
 // Constructor
 
 QADB :: QADB (string qadbfile, string respfile, UINT hs = 100,
-	      MatchMode mm = MATCH_MAXLEN, SimOp so = SO_COSINUS)
-  : m_maxcode(0), m_tfidfmatrix(so), m_heapsize(hs),
-    m_matchmode(mm), m_simop(so)
+	      MatchMode mm = MATCH_MAXLEN, SimOp so = SO_COSINUS, int nt)
+  : m_loaded(false), m_indexed(0), m_generation(0), m_tfidfmatrix(so), m_maxcode(0), m_remaining(0),
+    m_matchmode(mm),
+    m_simop(so), m_heapsize(hs), m_threads(nt)
 {
-  load_responses(respfile);
-  load_examples(qadbfile);
+  UINT i;
+
+  for (i=0; i<POWTAB_SIZE; i++) m_powtab[i] = pow(static_cast<double>(i),1.0001);
+  // the optimization methods need the scores of all Q&A pairs
+  m_context.set_exhaustive(true);
+  m_loaded = load_responses(respfile);
+  m_loaded = load_examples(qadbfile) and m_loaded;
+}
+
+QADB :: QADB (string imagefile, UINT hs, MatchMode mm, SimOp so, int nt)
+  : m_loaded(false), m_indexed(0), m_generation(0), m_tfidfmatrix(so), m_maxcode(0), m_remaining(0),
+    m_matchmode(mm),
+    m_simop(so), m_heapsize(hs), m_threads(nt)
+{
+  UINT i;
+
+  for (i=0; i<POWTAB_SIZE; i++) m_powtab[i] = pow(static_cast<double>(i),1.0001);
+  m_context.set_exhaustive(true);
+  m_loaded = load_image(imagefile);
+}
+
+// register Q&A pair (hot fields and text are stored separately)
+
+void QADB :: add_qapair (const QAPair & pair)
+{
+  map<UINT,UINT>::iterator it;
+  QAText text;
+  UINT slot;
+
+  // response slot, new response IDs are appended to m_residlist
+  it = m_resid2slot.find(pair.m_resid);
+  if (it == m_resid2slot.end()) {
+    slot = m_residlist.size();
+    m_resid2slot[pair.m_resid] = slot;
+    m_residlist.push_back(pair.m_resid);
+    m_slotfirst.push_back(qadb_size());
+    m_slotlast.push_back(qadb_size());
+    m_slotsize.push_back(0);
+    m_slotactive.push_back(0);
+  } else {
+    slot = it->second;
+    m_slotnext[m_slotlast[slot]] = qadb_size();
+    m_slotlast[slot] = qadb_size();
+    // a slot whose Q&A pairs were all removed is represented by the new one
+    if (m_slotsize[slot] == 0) m_slotfirst[slot] = qadb_size();
+  }
+  m_slots.push_back(slot);
+  m_slotnext.push_back(NO_QAINDEX);
+  m_slotsize[slot] += 1;
+  if (pair.m_active) m_slotactive[slot] += 1;
+  m_remaining += 1;
+
+  m_actives.push_back(pair.m_active);
+  m_removed.push_back(false);
+  m_resids.push_back(pair.m_resid);
+  m_seqlens.push_back(pair.m_seqlen);
+  m_scores.push_back(pair.m_score);
+  m_exacts.push_back(pair.m_exact);
+  m_qatext.push_back(text);
+  m_qatext.back().m_hypcnt   = pair.m_hypcnt;
+  m_qatext.back().m_question = pair.m_question;
+  m_qatext.back().m_response = pair.m_response;
+  m_qatext.back().m_codeseq  = pair.m_codeseq;
+  m_qatext.back().m_morphseq = pair.m_morphseq;
+}
+
+// change usable Q&A pairs, removed Q&A pairs stay unusable
+
+void QADB :: set_active (UINT index, bool active)
+{
+  active = active and not m_removed.test(index);
+  if (active and not m_actives.test(index)) m_slotactive[m_slots[index]] += 1;
+  if (not active and m_actives.test(index)) m_slotactive[m_slots[index]] -= 1;
+  m_actives.assign(index, active);
+  m_generation++;
+}
+
+// access Q&A pair by internal index
+
+QAPair QADB :: qapair (UINT index) const
+{
+  QAPair pair;
+
+  pair.m_active   = m_actives.test(index);
+  pair.m_exact    = m_exacts[index];
+  pair.m_index    = index;
+  pair.m_seqlen   = m_seqlens[index];
+  pair.m_resid    = m_resids[index];
+  pair.m_hypcnt   = m_qatext[index].m_hypcnt;
+  pair.m_score    = m_scores[index];
+  pair.m_question = m_qatext[index].m_question;
+  pair.m_response = m_qatext[index].m_response;
+  pair.m_codeseq  = m_qatext[index].m_codeseq;
+  pair.m_morphseq = m_qatext[index].m_morphseq;
+  return pair;
 }
 
 // load question-answer pairs
@@ -36,8 +130,12 @@ bool QADB :: load_examples (string file)
   vector<string> tokens;
   QAPair         pair;
   UINT           cnt = 0;
-  UINT           i, n;
 
+  if (not *infile) {
+    cerr << "Error: cannot read " << file << endl;
+    delete infile;
+    return false;
+  }
   cerr << "Loading Database:" << endl;
   m_morph2code.clear();
   while (!infile->eof()) {
@@ -48,6 +146,8 @@ bool QADB :: load_examples (string file)
     tokens = split(&buffer[0], ' ');
     if (tokens.size() == 2) {
       pair.m_active   = true;
+      pair.m_exact    = false;
+      pair.m_score    = 0.0;
       // set number of hypotheses to one (in case example is used as query)
       pair.m_hypcnt   = 1;
       // response identifier
@@ -67,15 +167,8 @@ bool QADB :: load_examples (string file)
       pair.m_codeseq  = sent2codeseq(pair.m_morphseq);
       // reference index
       pair.m_index = cnt;
-      // register Q&A pair
-      m_qaset.push_back(pair);
-      // make list of response IDs and count response IDs
-      if (find(m_residlist.begin(),m_residlist.end(),pair.m_resid) == m_residlist.end()) {
-	m_residlist.push_back(pair.m_resid);
-	m_resid2prior[pair.m_resid]  = 1.0;
-      } else {
-	m_resid2prior[pair.m_resid] += 1.0;
-      }
+      // register Q&A pair (and its response ID)
+      add_qapair(pair);
       cnt += 1;
       indicator(cnt, 100);
     }
@@ -83,12 +176,6 @@ bool QADB :: load_examples (string file)
   infile->close();
   indicator(cnt, 0);
 
-  // calculate response prior probabilities
-  n = m_residlist.size();
-  for (i=0; i<n; i++) {
-    m_resid2prior[m_residlist[i]] /= static_cast<float>(cnt);
-  }
-
   // make index, i.e. mapping from morphemes to Q&A indentifiers
   make_index();
 
@@ -105,8 +192,8 @@ bool QADB :: save_examples (string file)
   
   n = qadb_size();
   for (i=0; i<n; i++) {
-    if (m_qaset[i].m_active) {
-      *outfile << m_qaset[i].m_resid << " " << m_qaset[i].m_question << endl;
+    if (m_actives.test(i)) {
+      *outfile << m_resids[i] << " " << m_qatext[i].m_question << endl;
     }
   }
   outfile->close();
@@ -115,6 +202,186 @@ bool QADB :: save_examples (string file)
   return true;
 }
 
+// write compiled image of the database (see load_image for the layout)
+
+bool QADB :: compile (string file)
+{
+  CImageWriter image(file.c_str());
+  map<string,UINT>::const_iterator mt;
+  map<UINT,Response>::const_iterator rt;
+  UINT i, k, n;
+
+  // the image holds one index over all Q&A pairs
+  if (m_indexed != qadb_size()) make_index();
+
+  cerr << "Compiling Database:" << endl;
+  image.put(string(IMAGE_MAGIC));
+  image.put(static_cast<UINT>(IMAGE_VERSION));
+  // example analysis depends on the match mode
+  image.put(static_cast<UINT>((m_matchmode != MATCH_TFIDF and
+			       m_matchmode != MATCH_CONF) ? 1 : 0));
+
+  // lexicon
+  image.put(m_maxcode);
+  image.put(static_cast<UINT>(m_morph2code.size()));
+  for (mt=m_morph2code.begin(); mt!=m_morph2code.end(); mt++) {
+    image.put(mt->second);
+    image.put(mt->first);
+  }
+
+  // response sentences
+  image.put(static_cast<UINT>(m_resid2response.size()));
+  for (rt=m_resid2response.begin(); rt!=m_resid2response.end(); rt++) {
+    image.put(rt->first);
+    image.put(rt->second.m_message);
+  }
+
+  // analyzed examples
+  n = qadb_size();
+  image.put(n);
+  for (i=0; i<n; i++) {
+    if (i > 0) indicator(i, 1000);
+    const QAText & text = m_qatext[i];
+    // 0: inactive, 1: active, 2: removed
+    image.put(static_cast<UINT>(m_removed.test(i) ? 2 : (m_actives.test(i) ? 1 : 0)));
+    image.put(m_resids[i]);
+    image.put(m_seqlens[i]);
+    image.put(static_cast<UINT>(text.m_hypcnt));
+    image.put(text.m_question);
+    image.put((text.m_codeseq.size() > 0) ? &text.m_codeseq[0] : NULL,
+	      text.m_codeseq.size());
+    image.put(static_cast<UINT>(text.m_morphseq.size()));
+    for (k=0; k<text.m_morphseq.size(); k++) {
+      image.put(text.m_morphseq[k].m_origin);
+      image.put(text.m_morphseq[k].m_yomi);
+      image.put(text.m_morphseq[k].m_basis);
+      image.put(static_cast<UINT>(text.m_morphseq[k].m_poscode));
+      image.put(static_cast<UINT>(text.m_morphseq[k].m_conjform));
+      image.put(static_cast<UINT>(text.m_morphseq[k].m_conjtype));
+    }
+  }
+  indicator(n, 0);
+
+  // postings
+  m_index.save(image);
+
+  if (not image.close()) {
+    cerr << "Error: cannot write image " << file << endl;
+    return false;
+  }
+  return true;
+}
+
+// load compiled image into an empty database: no morphological
+// analysis, the postings are used in place, length buckets and
+// the other tables are derived from the examples as in make_index
+
+bool QADB :: load_image (string file)
+{
+  QAPair pair;
+  Morpheme morph;
+  string str;
+  const UINT * codes;
+  UINT i, k, n, m, code, resid, state;
+
+  cerr << "Loading Image:" << endl;
+  if (not m_image.open(file.c_str()) or m_image.get_string() != IMAGE_MAGIC or
+      m_image.get_uint() != IMAGE_VERSION) {
+    cerr << "Error: " << file << " is no database image (version ";
+    cerr << IMAGE_VERSION << ")." << endl;
+    m_image.close();
+    return false;
+  }
+  if (m_image.get_uint() != ((m_matchmode != MATCH_TFIDF and
+			      m_matchmode != MATCH_CONF) ? 1U : 0U)) {
+    cerr << "Error: image " << file << " was compiled for another match mode." << endl;
+    m_image.close();
+    return false;
+  }
+
+  // lexicon
+  m_maxcode = m_image.get_uint();
+  n = m_image.get_uint();
+  for (i=0; i<n and m_image.good(); i++) {
+    code = m_image.get_uint();
+    str  = m_image.get_string();
+    m_morph2code[str] = code;
+    if (code != 0) m_code2morph[code] = str;
+  }
+
+  // response sentences
+  n = m_image.get_uint();
+  for (i=0; i<n and m_image.good(); i++) {
+    resid = m_image.get_uint();
+    m_resid2response[resid].m_message = m_image.get_string();
+    m_resid2response[resid].m_ident   = resid;
+  }
+
+  // analyzed examples
+  n = m_image.get_uint();
+  for (i=0; i<n and m_image.good(); i++) {
+    state           = m_image.get_uint();
+    pair.m_active   = (state == 1);
+    pair.m_exact    = false;
+    pair.m_score    = 0.0;
+    pair.m_index    = i;
+    pair.m_resid    = m_image.get_uint();
+    pair.m_seqlen   = m_image.get_uint();
+    pair.m_hypcnt   = static_cast<int>(m_image.get_uint());
+    pair.m_question = m_image.get_string();
+    pair.m_response = m_resid2response[pair.m_resid].m_message;
+    codes = m_image.get_words(m);
+    pair.m_codeseq.assign(codes, codes + m);
+    m = m_image.get_uint();
+    pair.m_morphseq.clear();
+    for (k=0; k<m and m_image.good(); k++) {
+      morph.m_origin   = m_image.get_string();
+      morph.m_yomi     = m_image.get_string();
+      morph.m_basis    = m_image.get_string();
+      morph.m_poscode  = static_cast<int>(m_image.get_uint());
+      morph.m_conjform = static_cast<int>(m_image.get_uint());
+      morph.m_conjtype = static_cast<int>(m_image.get_uint());
+      pair.m_morphseq.push_back(morph);
+    }
+    add_qapair(pair);
+    if (state == 2) {
+      m_removed.set(i);
+      m_slotsize[m_slots[i]] -= 1;
+      m_remaining -= 1;
+    }
+    indicator(i+1, 100);
+  }
+  indicator(qadb_size(), 0);
+
+  // the first remaining Q&A pair represents its slot
+  for (k=0; k<m_slotfirst.size(); k++) {
+    for (i=m_slotfirst[k]; i != NO_QAINDEX and m_removed.test(i); i=m_slotnext[i]);
+    if (i != NO_QAINDEX) m_slotfirst[k] = i;
+  }
+
+  cerr << "Making Term->Entry Index:" << endl;
+  make_buckets();
+  if (not m_image.good() or not m_index.attach(m_image)) {
+    cerr << "Error: image " << file << " is truncated or damaged." << endl;
+    m_image.close();
+    m_index.clear();
+    return false;
+  }
+  m_indexed = qadb_size();
+  make_tables();
+
+  return true;
+}
+
+// does file start like a compiled image?
+
+bool QADB :: is_image (string file)
+{
+  CImageReader image;
+
+  return image.open(file.c_str()) and image.get_string() == IMAGE_MAGIC;
+}
+
 // load validation data (text or speech recognition result)
 
 bool QADB :: load_validata (istream * infile)
@@ -124,7 +391,6 @@ bool QADB :: load_validata (istream * infile)
   Sentence       morphseq;
   vector<string> tokens;
   vector<string> hypvec;
-  UINT           i;
   QAPair         pair;
   UINT           cnt = 0;
 
@@ -175,9 +441,8 @@ bool QADB :: load_morphconftable (string file)
   char            buffer[MAX_BUFLEN+1] = { 0 };
   char            separator[3] = {' ','\t','\0'};
   char *          strp;
-  UINT            i, j, n, cnt=0;
+  UINT            i, j, cnt=0;
   UINT            refc, hypc;
-  char            str[12] = { 0 };
   string          refm, hypm;
   float           prob;
   map<UINT,float> marginal;
@@ -245,6 +510,7 @@ bool QADB :: load_morphconftable (string file)
   // known as [Fano's inequality]
   error = (entropy - 1.0) / (log(static_cast<float>(m_maxcode)) - 1.0);
   cerr << "H(hyp|ref) = " << entropy << ", P(error) >= " << error << endl;
+  m_generation++;
 
   return true;
 }
@@ -256,7 +522,6 @@ QADB :: load_stoplist(string file)
 {
   ifstream *     infile = new ifstream(file.c_str());
   char           buffer[MAX_BUFLEN+1] = { 0 };
-  char           str[12] = { 0 };
   UINT           cnt=0, code;
 
   cerr << "Loading Stopword List:" << endl;
@@ -274,6 +539,7 @@ QADB :: load_stoplist(string file)
   if (infile) delete infile;
 
   m_tfidfmatrix.add_stoplist(m_stoplist);
+  m_generation++;
 
   return true;
 }
@@ -300,47 +566,209 @@ QADB :: save_stoplist(string file)
 
 void QADB :: make_index (void)
 {
-  UINT i, k, n, m, resid;
-  string token;
+  UINT i, k, n;
+  vector< const vector<UINT> * > docs;
 
   cerr << "Making Term->Entry Index:" << endl;
 
-  m_morph2indexlist.clear();
-  m_code2indexlist.clear();
+  make_buckets();
+
+  // mapping from morpheme codes to positions of active Q&A pairs
+  // (two counting passes), postings lists are grouped by length bucket
+  n = qadb_size();
+  docs.assign(n, NULL);
+  for (k=0; k<n; k++) {
+    i = m_order[k];
+    if (m_actives.test(i)) docs[k] = &m_qatext[i].m_codeseq;
+  }
+  m_index.build(docs, m_maxcode, m_threads);
+  m_addindex.clear();
+  m_indexed = n;
+
+  make_tables();
+}
+
+// index positions and length buckets
+
+void QADB :: make_buckets (void)
+{
+  UINT i, k, n, m;
+  vector< pair<UINT,UINT> > lenidx;
+  LengthBucket bucket;
+
+  // order Q&A pairs by length (and index), positions of
+  // Q&A pairs of the same length form a length bucket
+  n = qadb_size();
+  lenidx.resize(n);
+  for (i=0; i<n; i++) lenidx[i] = make_pair(m_seqlens[i], i);
+  sort(lenidx.begin(), lenidx.end());
+  m_order.resize(n);
+  m_rank.resize(n);
+  m_buckets.clear();
+  m_len2bucket.clear();
+  for (k=0; k<n; k++) {
+    m = lenidx[k].first;
+    i = lenidx[k].second;
+    m_order[k] = i;
+    m_rank[i]  = k;
+    if (m_buckets.size() == 0 or m_buckets.back().m_seqlen != m) {
+      bucket.m_seqlen = m;
+      bucket.m_first  = k;
+      m_buckets.push_back(bucket);
+      m_len2bucket.resize(m+1, 0);
+      m_len2bucket[m] = m_buckets.size() - 1;
+    }
+    m_buckets.back().m_last = k+1;
+  }
+}
+
+// tables derived from the indexed Q&A pairs (after the postings)
+
+void QADB :: make_tables (void)
+{
+  UINT i, n;
+  vector<UINT> codes;
 
-  // mapping from morphemes (as text or code) to response ID list
   n = qadb_size();
+  m_generation++;
+
+  // exact match table over the indexed Q&A pairs
+  m_exactindex.clear();
+  for (i=0; i<n; i++) {
+    if (not m_actives.test(i)) continue;
+    codes = m_qatext[i].m_codeseq;
+    sort(codes.begin(), codes.end());
+    m_exactindex[code_hash(codes)].push_back(i);
+  }
+
+  m_slottfvector.assign(m_residlist.size(), CTermVector<UINT>());
   for (i=0; i<n; i++) {
     if (i > 0) indicator(i, 1000);
-    if (m_qaset[i].m_active) {
-      m = m_qaset[i].m_morphseq.size();
-      for (k=0; k<m; k++) {
-	token = m_qaset[i].m_morphseq[k].m_origin;
-	m_morph2indexlist[token].push_back(i);
-	m_code2indexlist[m_qaset[i].m_codeseq[k]].push_back(i);
-      }
+    if (m_actives.test(i)) {
       // make a tf-vector for each question set
       // corresponding to the same response identifier
-      m_resid2tfvector[m_qaset[i].m_resid].add_termlist(m_qaset[i].m_codeseq);
-      // m_resid2tfvector[i].add_termlist(m_qaset[i].m_codeseq);
+      m_slottfvector[m_slots[i]].add_termlist(m_qatext[i].m_codeseq);
     }
   }
   indicator(n, 0);
 
   if (m_matchmode == MATCH_TFIDF) {
     cerr << "Making TF/IDF Matrix:" << endl;
-    // make tf-idf matrix
-    k = m_residlist.size();
-    // k = qadb_size();
-    for (i=0; i<k; i++) {
-      if (i>0) indicator(i, 1000);
-      resid = m_residlist[i];
-      m_tfidfmatrix.add_document(m_resid2tfvector[resid], resid);
-      // m_tfidfmatrix.add_document(m_resid2tfvector[i], i);
-    }
-    m_tfidfmatrix.to_tfidf();
-    indicator(k, 0);
+    make_tfidf();
+    indicator(m_residlist.size(), 0);
+  }
+}
+
+// (re)make tf-idf matrix from the tf-vectors of the response slots
+
+void QADB :: make_tfidf (void)
+{
+  UINT i, k;
+
+  m_tfidfmatrix.del_documents();
+  k = m_residlist.size();
+  for (i=0; i<k; i++) {
+    // slots whose Q&A pairs were all removed
+    if (m_slotsize[i] == 0) continue;
+    m_tfidfmatrix.add_document(m_slottfvector[i], m_residlist[i]);
+  }
+  m_tfidfmatrix.to_tfidf();
+}
+
+// reweight the tf-idf rows after the tf-vector of a response slot
+// changed (same documents): the slot itself and the slots sharing
+// a term which entered or left it
+
+void QADB :: update_tfidf (UINT slot)
+{
+  vector<UINT> stale;
+  UINT k;
+
+  m_tfidfmatrix.update_document(m_slottfvector[slot], m_residlist[slot], stale);
+  for (k=0; k<stale.size(); k++)
+    m_tfidfmatrix.reweight_document(m_slottfvector[m_resid2slot[stale[k]]], stale[k]);
+}
+
+// add example question for response ID (analyzed as in load_examples),
+// returns the index of the new Q&A pair
+
+UINT QADB :: add_example (UINT resid, const char * question)
+{
+  QAPair pair;
+  vector<UINT> codes;
+  UINT i, k, slot;
+
+  pair.m_active   = true;
+  pair.m_exact    = false;
+  pair.m_score    = 0.0;
+  pair.m_hypcnt   = 1;
+  pair.m_resid    = resid;
+  pair.m_question = question;
+  pair.m_response = m_resid2response[resid].m_message;
+  pair.m_morphseq = parse_sentence(question);
+  pair.m_seqlen   = pair.m_morphseq.size();
+  if (m_matchmode != MATCH_TFIDF and m_matchmode != MATCH_CONF)
+    pair.m_morphseq = validate_sentence(pair.m_morphseq);
+  pair.m_codeseq  = sent2codeseq(pair.m_morphseq);
+  pair.m_index    = qadb_size();
+  add_qapair(pair);
+  i    = pair.m_index;
+  slot = m_slots[i];
+
+  // extra postings and exact match table
+  if (m_addindex.size() <= m_maxcode) m_addindex.resize(m_maxcode + 1);
+  for (k=0; k<pair.m_codeseq.size(); k++) m_addindex[pair.m_codeseq[k]].push_back(i);
+  codes = pair.m_codeseq;
+  sort(codes.begin(), codes.end());
+  m_exactindex[code_hash(codes)].push_back(i);
+
+  // the new Q&A pair is the last one of its slot, a new
+  // (or revived) slot changes the number of tf-idf documents
+  if (m_slottfvector.size() <= slot) m_slottfvector.resize(slot + 1);
+  m_slottfvector[slot].add_termlist(pair.m_codeseq);
+  if (m_matchmode == MATCH_TFIDF) {
+    if (m_slotsize[slot] == 1) make_tfidf();
+    else update_tfidf(slot);
+  }
+  m_generation++;
+
+  // fold the extra postings into the index when they get too long
+  if (qadb_size() - m_indexed > m_indexed / 8 + 64) make_index();
+
+  return i;
+}
+
+// remove Q&A pair, returns false if there is no such Q&A pair
+
+bool QADB :: remove_example (UINT index)
+{
+  UINT i, n, slot;
+  bool active;
+
+  n = qadb_size();
+  if (index >= n or m_removed.test(index)) return false;
+  active = m_actives.test(index);
+  m_removed.set(index);
+  set_active(index, false);
+
+  slot = m_slots[index];
+  m_slotsize[slot] -= 1;
+  m_remaining -= 1;
+  // the first remaining Q&A pair represents the slot
+  if (m_slotfirst[slot] == index) {
+    for (i=m_slotnext[index]; i != NO_QAINDEX and m_removed.test(i); i=m_slotnext[i]);
+    if (i != NO_QAINDEX) m_slotfirst[slot] = i;
+  }
+
+  // tf-vector of the slot without the removed Q&A pair,
+  // an emptied slot leaves the tf-idf matrix
+  if (active) m_slottfvector[slot].remove_termlist(m_qatext[index].m_codeseq);
+  if (m_matchmode == MATCH_TFIDF) {
+    if (m_slotsize[slot] == 0) make_tfidf();
+    else update_tfidf(slot);
   }
+
+  return true;
 }
 
 // load list of response sentences
@@ -352,6 +780,11 @@ bool QADB :: load_responses (string file)
   vector<string> tokens;
   UINT resid;
 
+  if (not *infile) {
+    cerr << "Error: cannot read " << file << endl;
+    delete infile;
+    return false;
+  }
   while (!infile->eof()) {
     infile->getline(&buffer[0], MAX_BUFLEN);
     if (buffer[0] == '#' || buffer[0] == ' ' || strlen(buffer) < 4) continue;
@@ -396,10 +829,10 @@ void QADB :: looeval(ostream * outfile)
   if (n == m_valiqaset.size()) {
     for (c=0, j=0; j<n; j++) {
       if (j > 0) indicator(j, 100);
-      m_qaset[j].m_active = false;
+      set_active(j, false);
       qapair = retrieve(m_valiqaset[j].m_morphseq, m_valiqaset[j].m_hypcnt);
       if (qapair.m_resid == m_valiqaset[j].m_resid) c++;
-      m_qaset[j].m_active = true;
+      set_active(j, true);
       *outfile << qapair.m_resid << " " << qapair.m_score << " " << qapair.m_response << endl;
     }
     indicator(j, 0);
@@ -416,16 +849,16 @@ void QADB :: looeval(ostream * outfile)
 void QADB :: cvlabel(ostream * outfile)
 {
   CMaxHeap<float,UINT> * tmpheap = NULL;
-  map <UINT,float> count;
-  map <UINT,float> score;
+  vector<float> count;
+  vector<float> score;
   UINT    a,i,j,k,n,m,c;
   QAPair  qapair;
   float   rate;
   float   maxrate = 0.0;
   UINT  * save_index = NULL;
   float * save_score = NULL;
-  bool    success = false;
   UINT    bestresid = 0;
+  UINT    bestslot = 0;
   UINT    inc=0,dec=0,eqr=0;
 
   cerr << "Making Score Heap..." << endl;
@@ -440,13 +873,13 @@ void QADB :: cvlabel(ostream * outfile)
   for (c=0,i=0; i<n; i++) {
     if (i > 0) indicator(i, 10);
     tmpheap = new CMaxHeap<float,UINT>(static_cast<int>(n));
-    qapair = retrieve(m_qaset[i].m_morphseq, m_qaset[i].m_hypcnt);
+    qapair = retrieve(m_qatext[i].m_morphseq, m_qatext[i].m_hypcnt);
     for (j=0; j<n; j++) {
-      if (i != j) tmpheap->push(m_qaset[j].m_score, j);
+      if (i != j) tmpheap->push(m_scores[j], j);
     }
     tmpheap->pop(&save_index[i], &save_score[i]);
     delete tmpheap;
-    if (m_qaset[save_index[i]].m_resid == m_qaset[i].m_resid) c++;
+    if (m_resids[save_index[i]] == m_resids[i]) c++;
   }
   indicator(i, 0);
 
@@ -456,35 +889,34 @@ void QADB :: cvlabel(ostream * outfile)
   cerr << "Unsupervised CV Labeling" << endl;
   for (a=0,j=0; j<m; j++) {
     // initialization
-    for (k=0; k<m_residlist.size(); k++) {
-      count[m_residlist[k]] = 0;
-      score[m_residlist[k]] = 0.0;
-    }
+    count.assign(m_residlist.size(), 0.0);
+    score.assign(m_residlist.size(), 0.0);
     // find best matching example question in the database
     qapair = retrieve(m_valiqaset[j].m_morphseq, m_valiqaset[j].m_hypcnt);
     for (c=0,i=0; i<n; i++) {
-      if (m_qaset[i].m_score >= save_score[i]) {
+      if (m_scores[i] >= save_score[i]) {
 	// score higher than best matching LOO example
 	// count occurrence of the response identifiers
-	count[m_qaset[i].m_resid] += 1;
-	score[m_qaset[i].m_resid] += 1.0;
-	if (m_qaset[save_index[i]].m_resid == m_qaset[i].m_resid)
-	  score[m_qaset[save_index[i]].m_resid] += 1.0;
+	count[m_slots[i]] += 1;
+	score[m_slots[i]] += 1.0;
+	if (m_resids[save_index[i]] == m_resids[i])
+	  score[m_slots[save_index[i]]] += 1.0;
       } else {
 	// score lower than best matching LOO example
-        if (m_qaset[save_index[i]].m_resid == m_qaset[i].m_resid) c++;
+        if (m_resids[save_index[i]] == m_resids[i]) c++;
       }
     }
     // find best response ID
     // finally reset counters for next query
-    bestresid = m_residlist[0];
+    bestslot = 0;
     for (k=1; k<m_residlist.size(); k++) {
-      if (score[m_residlist[k]] > score[bestresid]) {
-	 bestresid = m_residlist[k];
+      if (score[k] > score[bestslot]) {
+	 bestslot = k;
       }
     }
+    bestresid = m_residlist[bestslot];
     // calculate new response accuracy
-    rate = static_cast<float>(c+count[bestresid])/static_cast<float>(n);
+    rate = static_cast<float>(c+count[bestslot])/static_cast<float>(n);
     if (rate > maxrate) {
       maxrate = rate;
       // adding example query increases response accuracy
@@ -493,8 +925,8 @@ void QADB :: cvlabel(ostream * outfile)
       inc ++;
       *outfile << bestresid << " " << m_valiqaset[j].m_question << endl;
       for (i=0; i<n; i++) {
-        if (m_qaset[i].m_score > save_score[i]) {
-          save_score[i] = m_qaset[i].m_score;
+        if (m_scores[i] > save_score[i]) {
+          save_score[i] = m_scores[i];
           save_index[i] = n+a;
         }
       }
@@ -504,7 +936,7 @@ void QADB :: cvlabel(ostream * outfile)
       qapair.m_active = false;
       qapair.m_index  = n+a;
       qapair.m_resid  = bestresid;
-      m_qaset.push_back(qapair);
+      add_qapair(qapair);
       a++;
     } else if (rate < maxrate) {
       // adding example query decreases response accuracy
@@ -529,11 +961,10 @@ void QADB :: cvlabel(ostream * outfile)
 
 void QADB :: valiopt(void)
 {
-  UINT i,j,k,l,n,m,c,t;
+  UINT i,j,k,n,m,c,t;
   QAPair qapair;
   float rate = 0.0;
   float maxrate = 0.0;
-  float score;
   CMaxHeap<float,UINT> ** heap = NULL;
   CMaxHeap<float,UINT> * tmpheap = NULL;
   UINT * save_index = NULL;
@@ -598,6 +1029,7 @@ void QADB :: valiopt(void)
 	    if (m_valiqaset[c2i[j][i]].m_resid == best) d--;
           }
 	  m_tfidfmatrix.add_stopterm(j);
+	  m_generation++;
 	  for (i=0;i<k;i++) {
 	    best = m_tfidfmatrix.retrieve(*tfvecs[c2i[j][i]]);
 	    if (m_valiqaset[c2i[j][i]].m_resid == best) d++;
@@ -627,6 +1059,7 @@ void QADB :: valiopt(void)
     }
     m_tfidfmatrix.del_stoplist();
     m_tfidfmatrix.add_stoplist(m_stoplist);
+    m_generation++;
     cerr << exclude << " terms excluded (" << loops << " iterations)." << endl;
     cerr << "Final RA=" << (100.0*maxrate) << endl;
     // free memory
@@ -644,7 +1077,7 @@ void QADB :: valiopt(void)
       tmpheap = new CMaxHeap<float,UINT>(static_cast<int>(n));
       qapair = retrieve(m_valiqaset[i].m_morphseq, m_valiqaset[i].m_hypcnt);
       for (j=0; j<n; j++) {
-	tmpheap->push(m_qaset[j].m_score, j);
+	tmpheap->push(m_scores[j], j);
       }
       if (m_heapsize >= n) {
 	heap[i] = tmpheap;
@@ -663,17 +1096,17 @@ void QADB :: valiopt(void)
     maxrate = static_cast<float>(c)/static_cast<float>(m);
     cerr << "Before Optimization: RA=" << (100.0*maxrate) << endl;
     for (i=0; i<n; i++) {
-      m_qaset[i].m_active = false;
+      set_active(i, false);
       for (c=0,j=0; j<m; j++) {
 	// get id of best-matching item from heap
 	success = heap[j]->front(&t);
 	k = 0;
-	while (success and not m_qaset[t].m_active) {
+	while (success and not m_actives.test(t)) {
 	  heap[j]->pop(&save_index[k], &save_score[k]);
 	  k++;
 	  success = heap[j]->front(&t);
 	}
-	if (success and m_qaset[t].m_active and m_qaset[t].m_resid == m_valiqaset[j].m_resid) c++;
+	if (success and m_actives.test(t) and m_resids[t] == m_valiqaset[j].m_resid) c++;
 	// push back items popped from heap
 	while (k-- > 0) heap[j]->push(save_score[k], save_index[k]);
       }
@@ -683,10 +1116,10 @@ void QADB :: valiopt(void)
 	cerr << "+";
 	exclude += 1;
       } else if (rate == maxrate) {
-	m_qaset[i].m_active = true;
+	set_active(i, true);
 	cerr << "=";
       } else {
-	m_qaset[i].m_active = true;
+	set_active(i, true);
 	cerr << "-";
       }
     }
@@ -723,9 +1156,9 @@ void QADB :: selfopt_matrix (void)
   for (c=0,j=0; j<n; j++) {
     if (j > 0) indicator(j, 10);
     matrix[j] = static_cast<float *>(calloc(n, sizeof(float)));
-    qapair = retrieve(m_qaset[j].m_morphseq, m_qaset[j].m_hypcnt);
-    for (i=0; i<n; i++) matrix[j][i] = m_qaset[i].m_score;
-    if (qapair.m_resid == m_qaset[j].m_resid) c++;
+    qapair = retrieve(m_qatext[j].m_morphseq, m_qatext[j].m_hypcnt);
+    for (i=0; i<n; i++) matrix[j][i] = m_scores[i];
+    if (qapair.m_resid == m_resids[j]) c++;
   }
   indicator(j, 0);
   // initial response accuracy
@@ -734,18 +1167,18 @@ void QADB :: selfopt_matrix (void)
   cerr << "Before Optimization: RA=" << (100.0*maxrate) << endl;
   cerr << "Optimizing ..." << endl;
   for (i=0; i<n; i++) {
-    m_qaset[i].m_active = false;
+    set_active(i, false);
     for (c=0,j=0; j<n; j++) {
       s = 0.0;
       t = 0;
       for (k=0; k<n; k++) {
 	// score table-lookup
-	if (matrix[j][k] > s and m_qaset[k].m_active) {
+	if (matrix[j][k] > s and m_actives.test(k)) {
 	  s = matrix[j][k];
 	  t = k;
 	}
       }
-      if (m_qaset[t].m_active and m_qaset[j].m_resid == m_qaset[t].m_resid) c++;
+      if (m_actives.test(t) and m_resids[j] == m_resids[t]) c++;
     }
     rate = static_cast<float>(c)/static_cast<float>(n);
     if (rate > maxrate) {
@@ -753,10 +1186,10 @@ void QADB :: selfopt_matrix (void)
       cerr << "+"; 
       exclude += 1;
     } else if (rate == maxrate) {
-      m_qaset[i].m_active = true;
+      set_active(i, true);
       cerr << "=";
     } else {
-      m_qaset[i].m_active = true;
+      set_active(i, true);
       cerr << "-";
     }
   }
@@ -799,9 +1232,9 @@ void QADB :: selfopt (void)
   for (c=0,i=0; i<n; i++) {
     if (i > 0) indicator(i, 10);
     tmpheap = new CMaxHeap<float,UINT>(static_cast<int>(n));
-    qapair = retrieve(m_qaset[i].m_morphseq, m_qaset[i].m_hypcnt);
+    qapair = retrieve(m_qatext[i].m_morphseq, m_qatext[i].m_hypcnt);
     for (j=0; j<n; j++) {
-      tmpheap->push(m_qaset[j].m_score, j);
+      tmpheap->push(m_scores[j], j);
     }
     if (m_heapsize >= n) {
       heap[i] = tmpheap;
@@ -813,8 +1246,8 @@ void QADB :: selfopt (void)
       }
       delete tmpheap;
     }
-    // assert(qapair.m_resid == m_qaset[t].m_resid);
-    if (qapair.m_resid == m_qaset[i].m_resid) c++;
+    // assert(qapair.m_resid == m_resids[t]);
+    if (qapair.m_resid == m_resids[i]) c++;
   }
   indicator(i, 0);
   // initial response accuracy
@@ -823,17 +1256,17 @@ void QADB :: selfopt (void)
   cerr << "Before Optimization: RA=" << (100.0*maxrate) << endl;
   cerr << "Optimizing ..." << endl;
   for (i=0; i<n; i++) {
-    m_qaset[i].m_active = false;
+    set_active(i, false);
     for (c=0,j=0; j<n; j++) {
       // get id of best-matching item from heap
       success = heap[j]->front(&t);
       k = 0;
-      while (success and not m_qaset[t].m_active) {
+      while (success and not m_actives.test(t)) {
 	heap[j]->pop(&save_index[k], &save_score[k]);
 	k++;
 	success = heap[j]->front(&t);
       }
-      if (success and m_qaset[t].m_active and m_qaset[t].m_resid == m_qaset[j].m_resid) c++;
+      if (success and m_actives.test(t) and m_resids[t] == m_resids[j]) c++;
       // push back items popped from heap
       while (k-- > 0) heap[j]->push(save_score[k], save_index[k]);
     }
@@ -843,10 +1276,10 @@ void QADB :: selfopt (void)
       cerr << "+";
       exclude += 1;
     } else if (rate == maxrate) {
-      m_qaset[i].m_active = true;
+      set_active(i, true);
       cerr << "=";
     } else {
-      m_qaset[i].m_active = true;
+      set_active(i, true);
       cerr << "-";
     }
   }
@@ -873,7 +1306,6 @@ void QADB :: selfopt_cv (void)
   UINT * save_index = NULL;
   float * save_score = NULL;
   bool success = false;
-  bool state;
   UINT exclude = 0;
 
   cerr << "Making Score Heap..." << endl;
@@ -884,10 +1316,10 @@ void QADB :: selfopt_cv (void)
   // check integrity of database and validation data
   if (n == m) {
     for (c=0,i=0; i<n; i++) {
-      if (m_qaset[i].m_resid == m_valiqaset[i].m_resid) {
+      if (m_resids[i] == m_valiqaset[i].m_resid) {
 	c++;
       } else {
-	cerr << m_qaset[i].m_resid << " " << m_valiqaset[i].m_resid << endl;
+	cerr << m_resids[i] << " " << m_valiqaset[i].m_resid << endl;
       }
     }
   } else {
@@ -909,17 +1341,17 @@ void QADB :: selfopt_cv (void)
   // make mapping of queries to ranklists of matching example questions
   // example questions are ranked by the matchscore with the query
   for (c=0,i=0; i<n; i++) {
-    m_qaset[i].m_active = false;
+    set_active(i, false);
     qapair = retrieve(m_valiqaset[i].m_morphseq, m_valiqaset[i].m_hypcnt);
     // mark datum as 'active' (initialization)
-    m_qaset[i].m_active = true;
+    set_active(i, true);
     // mark datum as 'dispensible' (initialization)
     m_valiqaset[i].m_active = false;
     // make heap for ranking example questions
     tmpheap = new CMaxHeap<float,UINT>(static_cast<int>(n));
     for (j=0; j<n; j++) {
       if (i != j)
-	tmpheap->push(m_qaset[j].m_score, j);
+	tmpheap->push(m_scores[j], j);
     }
     // memory reduction by reducing heap size
     if (m_heapsize >= n) {
@@ -948,19 +1380,19 @@ void QADB :: selfopt_cv (void)
     // find best matching example question with the correct response
     success = heap[i]->front(&t);
     k = 0;
-    while (success and m_qaset[t].m_resid != m_qaset[i].m_resid) {
+    while (success and m_resids[t] != m_resids[i]) {
       heap[i]->pop(&save_index[k], &save_score[k]);
       k++;
       success = heap[i]->front(&t);
     }
-    if (success and m_qaset[t].m_resid == m_qaset[i].m_resid) {
+    if (success and m_resids[t] == m_resids[i]) {
       // if an example question with correct response was found
       if (k > 0) {
 	for (j=0; j<k; j++) {
 	  // restore heap (necessary for final evaluation)
 	  heap[i]->push(save_score[j],save_index[j]);
 	  // deactivate interfering data
-	  m_qaset[save_index[j]].m_active = false;
+	  set_active(save_index[j], false);
 	}
 	// remember 'indispensible' data
 	m_valiqaset[t].m_active = true;
@@ -986,9 +1418,9 @@ void QADB :: selfopt_cv (void)
   for (i=0; i<n; i++) {
     // re-activate interfering data if it is 'indispensible'
     if (m_valiqaset[i].m_active == true)
-      m_qaset[i].m_active = true;
+      set_active(i, true);
     // count deactivated data
-    if (m_qaset[i].m_active == false)
+    if (m_actives.test(i) == false)
       exclude++;
   }
   cerr << exclude << " Items Excluded." << endl;
@@ -997,7 +1429,7 @@ void QADB :: selfopt_cv (void)
   for (c=0,i=0; i<n; i++) {
     success = heap[i]->front(&t);
     k = 0;
-    while (success and m_qaset[t].m_active == false) {
+    while (success and m_actives.test(t) == false) {
       heap[i]->pop(&save_index[k], &save_score[k]);
       k++;
       success = heap[i]->front(&t);
@@ -1006,7 +1438,7 @@ void QADB :: selfopt_cv (void)
     //   // restore heap
     //   heap[i]->push(save_score[k], save_index[k]);
     // }
-    if (m_qaset[t].m_active and m_qaset[t].m_resid == m_valiqaset[i].m_resid) c++;
+    if (success and m_actives.test(t) and m_resids[t] == m_valiqaset[i].m_resid) c++;
   }
 
   maxrate = static_cast<float>(c)/static_cast<float>(n);
@@ -1034,7 +1466,6 @@ void QADB :: selfopt_loocv (void)
   int * weight = NULL;
   float * save_score = NULL;
   bool success = false;
-  bool state;
   UINT exclude = 0;
 
   cerr << "Making Score Heap..." << endl;
@@ -1045,10 +1476,10 @@ void QADB :: selfopt_loocv (void)
   // check integrity of database and validation data
   if (n == m) {
     for (c=0,i=0; i<n; i++) {
-      if (m_qaset[i].m_resid == m_valiqaset[i].m_resid) {
+      if (m_resids[i] == m_valiqaset[i].m_resid) {
 	c++;
       } else {
-	cerr << m_qaset[i].m_resid << " " << m_valiqaset[i].m_resid << endl;
+	cerr << m_resids[i] << " " << m_valiqaset[i].m_resid << endl;
       }
     }
   } else {
@@ -1073,15 +1504,15 @@ void QADB :: selfopt_loocv (void)
   for (c=0,i=0; i<n; i++) {
     weight[i] = 0;
     // deactivate datum for cross-validation
-    m_qaset[i].m_active = false;
+    set_active(i, false);
     qapair = retrieve(m_valiqaset[i].m_morphseq, m_valiqaset[i].m_hypcnt);
     // mark datum as 'active' (initialization)
-    m_qaset[i].m_active = true;
+    set_active(i, true);
     // make heap for ranking example questions
     tmpheap = new CMaxHeap<float,UINT>(static_cast<int>(n));
     for (j=0; j<n; j++) {
       if (i != j)
-	tmpheap->push(m_qaset[j].m_score, j);
+	tmpheap->push(m_scores[j], j);
     }
     // reduce memory usage by reducing the heap size
     // actually, only the highest ranked example needs to be stored
@@ -1120,12 +1551,12 @@ void QADB :: selfopt_loocv (void)
 	  success = heap[j]->front(&t);
 	  heap[j]->push(save_score[0], save_index[0]);
 	  if (success) {
-	    if (m_valiqaset[j].m_resid == m_qaset[i].m_resid) {
+	    if (m_valiqaset[j].m_resid == m_resids[i]) {
 	      // increase weight if example is important
-	      if (m_valiqaset[j].m_resid != m_qaset[t].m_resid) weight[i]++;
+	      if (m_valiqaset[j].m_resid != m_resids[t]) weight[i]++;
 	    } else {
 	      // decrease weight if example has negative effect
-	      if (m_valiqaset[j].m_resid == m_qaset[t].m_resid) weight[i]--;
+	      if (m_valiqaset[j].m_resid == m_resids[t]) weight[i]--;
 	    }
 	  }
 	}
@@ -1135,7 +1566,7 @@ void QADB :: selfopt_loocv (void)
   indicator(n, 0);
   for (i=0; i<n; i++) {
     if (weight[i] < 0) {
-      m_qaset[i].m_active = false;
+      set_active(i, false);
       exclude++;
     }
   }
@@ -1145,7 +1576,7 @@ void QADB :: selfopt_loocv (void)
   for (c=0,i=0; i<n; i++) {
     success = heap[i]->front(&t);
     k = 0;
-    while (success and m_qaset[t].m_active == false) {
+    while (success and m_actives.test(t) == false) {
       heap[i]->pop(&save_index[k], &save_score[k]);
       k++;
       success = heap[i]->front(&t);
@@ -1154,7 +1585,7 @@ void QADB :: selfopt_loocv (void)
     //   // restore heap
     //   heap[i]->push(save_score[k], save_index[k]);
     // }
-    if (success and m_qaset[t].m_active and m_qaset[t].m_resid == m_valiqaset[i].m_resid) c++;
+    if (success and m_actives.test(t) and m_resids[t] == m_valiqaset[i].m_resid) c++;
   }
 
   rate = static_cast<float>(c)/static_cast<float>(n);
@@ -1186,124 +1617,289 @@ void QADB :: print_nbestresid (const char * query, int nbest)
 
 QAPair QADB :: retrieve (Sentence & query, int hypcnt)
 {
-  vector<UINT> codeseq;
-  UINT i,j,k,l,n,m,r,s,c;
+  QAQuery codes;
+  map<string,UINT> unknown;
+  UINT i,k,n,t;
+  QAResult result;
+  QAPair pair;
+
+  n = qadb_size();
+
+  // reset scores of Q&A pairs scored by the previous query
+  if (m_context.m_dense) {
+    t = (m_context.m_score.size() < n) ? m_context.m_score.size() : n;
+    for (i=0; i<t; i++) {
+      m_scores[i] = 0.0;
+      m_exacts[i] = false;
+    }
+  } else {
+    t = m_context.m_accu.used();
+    for (k=0; k<t; k++) {
+      i = m_context.m_accu.touched(k);
+      m_scores[i] = 0.0;
+      m_exacts[i] = false;
+    }
+  }
+
+  if (m_matchmode == MATCH_TFIDF) return retrieve_tfidf(query);
+
+  codes.assign(sent2codes(query, unknown), hypcnt);
+  result = retrieve(codes, m_context);
+
+  // keep match scores in the database for the optimization methods
+  if (m_context.m_dense) {
+    for (i=0; i<n; i++) m_scores[i] = m_context.m_score[i];
+  } else {
+    t = m_context.m_accu.used();
+    for (k=0; k<t; k++) {
+      i = m_context.m_accu.touched(k);
+      m_scores[i] = m_context.m_score[i];
+      m_exacts[i] = m_context.m_exact[i];
+    }
+  }
+
+  pair = qapair(result.m_index);
+  pair.m_score = result.m_score;
+  pair.m_resid = result.m_resid;
+  pair.m_exact = result.m_exact;
+
+  return pair;
+}
+
+// reentrant retrieve function
+// generate a response for given query string
+
+QAResult QADB :: retrieve (const char * query, QAContext & ctx) const
+{
+  QAQuery codes;
+
+  parse_query(query, codes);
+  return retrieve(codes, ctx);
+}
+
+QAResult QADB :: retrieve (const vector<UINT> & codeseq, int hypcnt,
+			   QAContext & ctx) const
+{
+  QAQuery query;
+
+  query.assign(codeseq, hypcnt);
+  return retrieve(query, ctx);
+}
+
+QAResult QADB :: retrieve (const QAQuery & query, QAContext & ctx) const
+{
+  vector<QAResult> results;
+  vector<UINT> key;
+  QAResult result;
+  ULONG start = timing_start();
+
+  ctx.m_acctime = 0;
+  // exhaustive contexts are read back completely,
+  // masked queries are not cached
+  if (m_cache.capacity() > 0 and not ctx.m_exhaustive and ctx.m_mask == NULL) {
+    key = cache_key(query, 1, false);
+    if (m_cache.lookup(key, m_generation, results)) {
+      ctx.prepare(qadb_size(), false);
+      timing_add(TIME_SCORE, timing_since(start));
+      return results[0];
+    }
+  }
+  if (not exact_match(query, ctx, result))
+    result = retrieve_topk(query, 1, false, ctx);
+  if (key.size() > 0) m_cache.insert(key, m_generation, vector<QAResult>(1, result));
+  timing_add(TIME_SCORE, timing_since(start) - ctx.m_acctime);
+  return result;
+}
+
+// exact match fast path (MATCH_MAXLEN, single hypothesis):
+// an example with the same morpheme set as the query reaches the
+// highest possible score, and every example with that score is an
+// exact match, so the lowest active one is the best Q&A pair.
+// other match modes can prefer subsets or supersets of the query
+
+bool QADB :: exact_match (const QAQuery & query, QAContext & ctx,
+			  QAResult & result) const
+{
+  __gnu_cxx::hash_map< UINT, vector<UINT> >::const_iterator it;
+  const vector<QueryTerm> & terms = query.terms();
+  vector<UINT> codes;
+  vector<UINT> excodes;
+  UINT i, k, n;
+
+  if (m_matchmode != MATCH_MAXLEN or query.hypcnt() != 1 or ctx.m_exhaustive)
+    return false;
+  n = terms.size();
+  if (n == 0) return false;
+  // unknown or repeated morphemes cannot match exactly
+  if (terms[n-1].m_code > m_maxcode or n != query.length()) return false;
+  codes.resize(n);
+  for (k=0; k<n; k++) codes[k] = terms[k].m_code;
+
+  it = m_exactindex.find(code_hash(codes));
+  if (it == m_exactindex.end()) return false;
+  for (k=0; k<it->second.size(); k++) {
+    i = it->second[k];
+    if (not m_actives.test(i) or m_seqlens[i] != n) continue;
+    if (ctx.m_mask and (i >= ctx.m_mask->size() or not ctx.m_mask->test(i))) continue;
+    excodes = m_qatext[i].m_codeseq;
+    sort(excodes.begin(), excodes.end());
+    if (excodes != codes) continue;
+    // leave the context as after a pruned retrieval
+    ctx.prepare(qadb_size(), false);
+    ctx.m_accu.add(i, n);
+    ctx.m_score[i] = count_score(i, n, static_cast<float>(n), 1);
+    ctx.m_exact[i] = true;
+    result.m_index = i;
+    result.m_resid = m_resids[i];
+    result.m_score = ctx.m_score[i];
+    result.m_exact = true;
+    return true;
+  }
+  return false;
+}
+
+// hash of a (sorted) code sequence
+
+UINT QADB :: code_hash (const vector<UINT> & codes) const
+{
+  UINT h = 2166136261U;
+  UINT k;
+
+  for (k=0; k<codes.size(); k++) h = (h ^ codes[k]) * 16777619U;
+  return h;
+}
+
+// nbest and uniqresp tell the pruning which results have to be exact
+
+QAResult QADB :: retrieve_topk (const QAQuery & query, UINT nbest,
+				bool uniqresp, QAContext & ctx) const
+{
+  const vector<UINT> & codeseq = query.codes();
+  const vector<QueryTerm> & terms = query.terms();
+  int hypcnt = query.hypcnt();
+  UINT i,j,k,l,n,m,t,w;
+  UINT r = 0, s = 0;
   float inlen, exlen, maxlen;
-  float f, score;
+  float score;
   float maxscore = 0.0;
-  string token;
-  UINT resid, len, best = 0;
-  UINT * mtcnts = NULL;
-  map<UINT,float> resid2score;
-  CMaxHeap<float,UINT> * heap = NULL;
+  UINT len, best = 0;
+  const UINT * postings;
+  vector<float> slotscore;
+  vector<UINT> slotindex;
+  map<UINT,string>::const_iterator it;
   vector<AlignElement> alignpath;
-  QAPair pair;
+  QAResult result;
 
   // some preparations
   n = qadb_size();
-  codeseq = sent2codeseq(query);
-  len = query.size();
+  len = query.length();
   inlen = static_cast<float>(len);
 
+  if (m_matchmode == MATCH_TFIDF) return retrieve_tfidf(query, ctx);
+
+  ctx.prepare(n, m_matchmode == MATCH_CONF);
+  const CBitSet & allowed = candidates(ctx);
+  ULONG start = timing_start();
+
   // table-based fast matching algorithm
-  if (m_matchmode != MATCH_TFIDF) {
-    mtcnts = static_cast<UINT *>(calloc(n, sizeof(UINT)));
-    for (j=0; j<len; j++) {
-      m = m_code2indexlist[codeseq[j]].size();
+  // only Q&A pairs reached via the index are touched,
+  // each distinct query term is looked up once with its weight
+  if (ctx.m_exhaustive or (m_matchmode != MATCH_MAXLEN and
+			   m_matchmode != MATCH_EXLEN and m_matchmode != MATCH_INLEN)) {
+    for (j=0; j<terms.size(); j++) {
+      m = m_index.size(terms[j].m_code);
+      postings = m_index.list(terms[j].m_code, ctx.m_postbuf);
+      w = terms[j].m_weight;
       for (k=0; k<m; k++) {
-	l = m_code2indexlist[codeseq[j]][k];
-	if (m_qaset[l].m_active) mtcnts[l]++;
+	l = m_order[postings[k]];
+	if (allowed.test(l)) ctx.m_accu.add(l, w);
       }
+      accumulate_added(terms[j].m_code, w, allowed, ctx);
     }
+  } else {
+    accumulate(query, nbest, uniqresp, allowed, ctx);
   }
+  ctx.m_acctime += timing_stop(TIME_ACCUMULATE, start);
+  t = ctx.m_accu.used();
   
   // match mode dependent processing
   switch(m_matchmode) {
   case MATCH_KBEST:
-    heap = new CMaxHeap<float,UINT>(n);
-    for (i=0;i<n;i++) {
-      exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      // prefer higher match counts / longer examples (heuristic)
-      m_qaset[i].m_score = pow(static_cast<double>(mtcnts[i]),1.0001) / maxlen;
-      heap->push(m_qaset[i].m_score, i);
-      mtcnts[i] = 0;
-    }
-    heap->front(&best, &maxscore);
-    pair = m_qaset[best];
-    for (i=0; i<n; i++) {
-      heap->pop(&c, &score);
-      resid = m_qaset[c].m_resid;
-      if (mtcnts[resid] < 5) {
-	resid2score[resid] += score;
-	mtcnts[resid] += 1;
-      }
-    }
+    score_counts(ctx, inlen, hypcnt);
+    best = kbest_scores(ctx, slotscore, slotindex);
+    result.m_index = best;
     maxscore = 0.0;
     m = m_residlist.size();
     for (j=0;j<m;j++) {
-      resid = m_residlist[j];
-      score = resid2score[resid]/static_cast<float>(mtcnts[resid]);
+      score = slotscore[j];
       if (score > maxscore) {
 	maxscore = score;
-	best = resid;
+	best = m_residlist[j];
       }
     }
-    pair.m_score = maxscore;
-    pair.m_resid = best;
-    break;
-  case MATCH_TFIDF:
-    pair = retrieve_tfidf(query);
+    result.m_score = maxscore;
+    result.m_resid = best;
+    result.m_exact = false;
     break;
   case MATCH_CONF:
     // experimental
     // employ morpheme confusion scores
     // use only single best hypothesis
     for (i=0; i<n; i++) {
-      alignpath = alignment(m_qaset[i].m_codeseq, codeseq);
+      if (not allowed.test(i)) {
+	ctx.m_score[i] = 0.0;
+	continue;
+      }
+      alignpath = alignment(m_qatext[i].m_codeseq, codeseq);
       len = alignpath.size();
       score = 0.0;
       for (j=0;j<len;j++) {
 	if (alignpath[j].m_type == ALIGN_COR || alignpath[j].m_type == ALIGN_SUB) {
-	  r = m_qaset[i].m_codeseq[alignpath[j].m_ref];
+	  r = m_qatext[i].m_codeseq[alignpath[j].m_ref];
 	  s = codeseq[alignpath[j].m_hyp];
 	} else if (alignpath[j].m_type == ALIGN_INS) {
 	  r = 0;
 	  s = codeseq[alignpath[j].m_hyp];
 	} else if (alignpath[j].m_type == ALIGN_DEL) {
-	  r = m_qaset[i].m_codeseq[alignpath[j].m_ref];
+	  r = m_qatext[i].m_codeseq[alignpath[j].m_ref];
 	  s = 0;
 	}
-	if (m_cftab_cp[r][s] != 0.0) {
-	  score += log(m_cftab_cp[r][s]);
+	if (conf_prob(r,s) != 0.0) {
+	  score += log(conf_prob(r,s));
 	} else {
-	  score += log(m_cftab_cp[0][0]);
+	  score += log(conf_prob(0,0));
 	}
       }
       if (score != 0.0) {
-	m_qaset[i].m_score = exp(score / static_cast<float>(len));
+	ctx.m_score[i] = exp(score / static_cast<float>(len));
       } else {
-	m_qaset[i].m_score = mtcnts[i] / static_cast<float>(maxlen);
+	exlen = static_cast<float>(m_seqlens[i] * hypcnt);
+	maxlen = (inlen > exlen) ? inlen : exlen;
+	ctx.m_score[i] = ctx.m_accu.count(i) / static_cast<float>(maxlen);
       }
-      if (m_qaset[i].m_score > maxscore) {
-	maxscore = m_qaset[i].m_score;
+      if (ctx.m_score[i] > maxscore) {
+	maxscore = ctx.m_score[i];
 	best = i;
       }
     }
-    pair = m_qaset[best];
+    result.m_index = best;
+    result.m_resid = m_resids[best];
+    result.m_score = ctx.m_score[best];
+    result.m_exact = false;
     // debug output for best-matching example
     if (m_matchmode == MATCH_CONF and debug == 3) {
-      cerr << "E" << best << " SCORE=" << m_qaset[best].m_score << endl;
-      alignpath = alignment(m_qaset[best].m_codeseq, codeseq);
+      cerr << "E" << best << " SCORE=" << ctx.m_score[best] << endl;
+      alignpath = alignment(m_qatext[best].m_codeseq, codeseq);
       len = alignpath.size();
       for (j=0;j<len;j++) {
 	if (alignpath[j].m_type == ALIGN_COR || alignpath[j].m_type == ALIGN_SUB) {
-	  r = m_qaset[best].m_codeseq[alignpath[j].m_ref];
+	  r = m_qatext[best].m_codeseq[alignpath[j].m_ref];
 	  s = codeseq[alignpath[j].m_hyp];
-	  if (m_cftab_cp[r].size() > 0) {
-	    cerr << "P(" << m_qaset[best].m_morphseq[alignpath[j].m_ref].m_origin;
-	    cerr << "|" << query[alignpath[j].m_hyp].m_origin << ")=";
-	    cerr << m_cftab_cp[r][s] << " ";
+	  if (m_cftab_cp.find(r) != m_cftab_cp.end()) {
+	    it = m_code2morph.find(s);
+	    cerr << "P(" << m_qatext[best].m_morphseq[alignpath[j].m_ref].m_origin;
+	    cerr << "|" << ((it != m_code2morph.end()) ? it->second : string("?")) << ")=";
+	    cerr << conf_prob(r,s) << " ";
 	  }
 	}
       }
@@ -1311,185 +1907,617 @@ QAPair QADB :: retrieve (Sentence & query, int hypcnt)
     }
     break;
   case MATCH_MAXLEN:
-    for (i=0; i<n; i++) {
-      exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      // prefer higher match counts / longer examples (heuristic)
-      m_qaset[i].m_score = pow(static_cast<double>(mtcnts[i]),1.0001) / maxlen;
-      if (m_qaset[i].m_score > maxscore) {
-	maxscore = m_qaset[i].m_score;
-	best = i;
-      }
-      if (inlen == exlen && inlen == mtcnts[i])
-	m_qaset[i].m_exact = true;
-      else
-	m_qaset[i].m_exact = false;
-    }
-    pair = m_qaset[best];
-    break;
   case MATCH_EXLEN:
-    for (i=0; i<n; i++) {
-      exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      m_qaset[i].m_score = static_cast<float>(mtcnts[i]) / exlen;
-      if (m_qaset[i].m_score > maxscore) {
-	maxscore = m_qaset[i].m_score;
-	best = i;
-      }
-      if (inlen == exlen && inlen == mtcnts[i])
-	m_qaset[i].m_exact = true;
-      else
-	m_qaset[i].m_exact = false;
-    }
-    pair = m_qaset[best];
-    break;
   case MATCH_INLEN:
-    for (i=0; i<n; i++) {
-      exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      m_qaset[i].m_score = static_cast<float>(mtcnts[i]) / inlen;
-      if (m_qaset[i].m_score > maxscore) {
-	maxscore = m_qaset[i].m_score;
-	best = i;
-      }
-      if (inlen == exlen && inlen == mtcnts[i])
-	m_qaset[i].m_exact = true;
-      else
-	m_qaset[i].m_exact = false;
-    }
-    pair = m_qaset[best];
-    break;
   case MATCH_BAYES:
-    for (i=0; i<n; i++) {
-      exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      // experimental
-      // prefer higher match counts / longer examples (heuristic)
-      score = pow(static_cast<double>(mtcnts[i]),1.0001) / maxlen;
-      m_qaset[i].m_score = score * m_resid2prior[m_qaset[i].m_resid];
-      if (m_qaset[i].m_score > maxscore) {
-	maxscore = m_qaset[i].m_score;
+    // untouched Q&A pairs score zero and cannot win,
+    // ties are resolved in favour of the lower index
+    score_counts(ctx, inlen, hypcnt);
+    for (k=0; k<t; k++) {
+      i = ctx.m_accu.touched(k);
+      if (ctx.m_score[i] > maxscore or
+	  (ctx.m_score[i] == maxscore and i < best)) {
+	maxscore = ctx.m_score[i];
 	best = i;
       }
-      if (inlen == exlen && inlen == mtcnts[i])
-	m_qaset[i].m_exact = true;
-      else
-	m_qaset[i].m_exact = false;
     }
-    pair = m_qaset[best];
     break;
   default:
     best = 0;
-    maxscore = 0;
-    for (i=0; i<n; i++) {
-      m_qaset[i].m_score = 0.0;
-      m_qaset[i].m_exact = false;
-    }
-    pair = m_qaset[best];
     break;
   }
 
-  if (mtcnts) free(mtcnts);
-  if (heap) delete heap;
+  if (m_matchmode != MATCH_KBEST and m_matchmode != MATCH_CONF) {
+    // best Q&A pair (index 0 if no Q&A pair matched at all)
+    exlen = static_cast<float>(m_seqlens[best] * hypcnt);
+    result.m_index = best;
+    result.m_resid = m_resids[best];
+    result.m_score = ctx.score(best);
+    result.m_exact = (inlen == exlen && inlen == ctx.m_accu.count(best));
+  }
 
-  return pair;
+  return result;
 }
 
-void QADB :: print_nbestresid (Sentence & query, int hypcnt, int nbest)
-{
-  vector<UINT> codeseq;
-  UINT i,j,k,l,n,m,r,s,c;
-  float inlen, exlen, maxlen;
-  float f, score;
-  float maxscore = 0.0;
-  string token;
-  UINT resid, len, best = 0;
-  UINT * mtcnts;
-  float * scores;
-  CMaxHeap<float,UINT> * heap; 
-  
-  n = qadb_size();
-  codeseq = sent2codeseq(query);
-  len = query.size();
+// average of the (up to) KBEST_SIZE best example scores per response
+// slot, Q&A pairs without matching morpheme count as zero scores.
+// a single pass over the touched Q&A pairs keeps the best scores of
+// each slot in a small sorted list (ties: lower index first).
+// returns the best-scoring example (MATCH_KBEST)
 
-  heap = new CMaxHeap<float,UINT>(n);
-  mtcnts = new UINT[n];
+UINT QADB :: kbest_scores (QAContext & ctx, vector<float> & slotscore,
+			   vector<UINT> & slotindex) const
+{
+  float * topscore;
+  UINT * topindex;
+  UINT i, k, c, s, t, m, best = 0;
+  float score, sum, maxscore = 0.0;
+
+  m = m_residlist.size();
+  if (ctx.m_topcount.size() < m) {
+    ctx.m_topscore.resize(m * KBEST_SIZE);
+    ctx.m_topindex.resize(m * KBEST_SIZE);
+    ctx.m_topcount.resize(m, 0);
+  }
 
-  // table-based fast matching algorithm
-  for (j=0; j<len; j++) {
-    m = m_code2indexlist[codeseq[j]].size();
-    for (k=0; k<m; k++) {
-      l = m_code2indexlist[codeseq[j]][k];
-      if (m_qaset[l].m_active) mtcnts[l]++;
+  t = ctx.m_accu.used();
+  for (k=0; k<t; k++) {
+    i = ctx.m_accu.touched(k);
+    score = ctx.m_score[i];
+    if (score > maxscore or (score == maxscore and i < best)) {
+      maxscore = score;
+      best = i;
+    }
+    s = m_slots[i];
+    topscore = &ctx.m_topscore[s * KBEST_SIZE];
+    topindex = &ctx.m_topindex[s * KBEST_SIZE];
+    c = ctx.m_topcount[s];
+    if (c == 0) ctx.m_topslots.push_back(s);
+    if (c == KBEST_SIZE) {
+      if (score < topscore[c-1] or
+	  (score == topscore[c-1] and i > topindex[c-1])) continue;
+      c--;
+    } else {
+      ctx.m_topcount[s] += 1;
+    }
+    // insertion into sorted list
+    while (c > 0 and (score > topscore[c-1] or
+		      (score == topscore[c-1] and i < topindex[c-1]))) {
+      topscore[c] = topscore[c-1];
+      topindex[c] = topindex[c-1];
+      c--;
     }
+    topscore[c] = score;
+    topindex[c] = i;
   }
 
-  inlen = static_cast<float>(len);
-  for (i=0; i<n; i++) {
-    exlen = static_cast<float>(m_qaset[i].m_seqlen * hypcnt);
-    switch(m_matchmode) {
-    case MATCH_MAXLEN:
-      maxlen = (inlen > exlen) ? inlen : exlen;
-      // prefer higher match counts / longer examples (heuristic)
-      score  = pow(static_cast<double>(mtcnts[i]),1.0001) / maxlen;
-      break;
-    case MATCH_EXLEN:
-      score = static_cast<float>(mtcnts[i]) / exlen;
-      break;
-    case MATCH_INLEN:
-      score = static_cast<float>(mtcnts[i]) / inlen;
-      break;
-    default:
-      assert(0);
-      break;
-    }
-    heap->push(score, m_qaset[i].m_resid);
-  }
-
-  i = 0;
-  while (heap->used()>0 &&  i<nbest) {
-    heap->pop(&resid,&score);
-    if (i==0)
-      cout << resid << ":" << score;
-    else
-      cout << "/" << resid << ":" << score;
-    i++;
+  // untouched slots score zero, represented by their first example
+  slotscore.assign(m, 0.0);
+  slotindex.assign(m_slotfirst.begin(), m_slotfirst.end());
+  for (k=0; k<ctx.m_topslots.size(); k++) {
+    s = ctx.m_topslots[k];
+    c = ctx.m_topcount[s];
+    for (sum=0.0, i=0; i<c; i++) sum += ctx.m_topscore[s * KBEST_SIZE + i];
+    c = (m_slotsize[s] < KBEST_SIZE) ? m_slotsize[s] : KBEST_SIZE;
+    slotscore[s] = sum/static_cast<float>(c);
+    slotindex[s] = ctx.m_topindex[s * KBEST_SIZE];
+    ctx.m_topcount[s] = 0;
   }
-  cout << endl;
+  ctx.m_topslots.clear();
 
-  delete heap;
-  delete [] mtcnts;
+  return best;
 }
 
-// tf-idf-matrix-based retrieve function
+// MaxScore-like postings walk for the count-based match modes:
+// query terms are visited from the rarest to the most frequent one.
+// a length bucket is closed as soon as the remaining terms cannot lift
+// any of its Q&A pairs not seen so far above the current n-best
+// threshold, the postings of closed buckets are then only used to
+// complete the counts of the Q&A pairs already seen
 
-QAPair QADB :: retrieve_tfidf (Sentence & query)
+static bool rarer_term (const QueryTerm & a, const QueryTerm & b)
 {
-  UINT i,n,best;
-  float score;
-  CTermVector<UINT> tfvec(m_simop);
-  QAPair pair;
-  
-  // pair.m_morphseq = query;
-  pair.m_codeseq = sent2codeseq(query);
-  tfvec.add_termlist(pair.m_codeseq);
-
-  best = m_tfidfmatrix.retrieve(tfvec, &score);
-  pair.m_score  = score;
-  pair.m_resid  = best;
-  pair.m_index  = 0;
-  pair.m_active = true;
-  pair.m_exact  = false;
-  pair.m_question = string("*");
-  pair.m_response = m_resid2response[best].m_message;
-  
-  // m_qaset[best].m_score = score;
-  // return m_qaset[best];
-
-  return pair;
+  return a.m_df < b.m_df or (a.m_df == b.m_df and a.m_code < b.m_code);
 }
 
-// helper functions
+void QADB :: accumulate (const QAQuery & query, UINT nbest, bool uniqresp,
+			 const CBitSet & allowed, QAContext & ctx) const
+{
+  int hypcnt = query.hypcnt();
+  vector<QueryTerm> terms;
+  vector<UBYTE> open;
+  vector< pair<const UINT *, const UINT *> > closed;
+  QueryTerm term;
+  const UINT * postings;
+  const UINT * pos;
+  const UINT * lo;
+  const UINT * hi;
+  UINT b, c, i, j, k, l, m, n, t, w, nb, nopen, rest, wmax, clen;
+  float inlen, theta;
+
+  n = query.length();
+  inlen = static_cast<float>(n);
+  if (n == 0 or hypcnt <= 0) return;
+
+  // distinct query terms with their number of occurrences
+  for (rest=0, wmax=0, j=0; j<query.terms().size(); j++) {
+    term      = query.terms()[j];
+    term.m_df = m_index.size(term.m_code);
+    if (term.m_code < m_addindex.size()) term.m_df += m_addindex[term.m_code].size();
+    if (term.m_df == 0) continue;
+    terms.push_back(term);
+    rest += term.m_weight;
+    if (term.m_weight > wmax) wmax = term.m_weight;
+  }
+  sort(terms.begin(), terms.end(), rarer_term);
+
+  nb = m_buckets.size();
+  nopen = nb;
+  open.assign(nb, 1);
+
+  for (j=0; j<terms.size(); j++) {
+    m = m_index.size(terms[j].m_code);
+    w = terms[j].m_weight;
+    postings = m_index.list(terms[j].m_code, ctx.m_postbuf);
+    // Q&A pairs added since make_index are never pruned
+    accumulate_added(terms[j].m_code, w, allowed, ctx);
+    t = ctx.m_accu.used();
+    // an unseen Q&A pair can match at most the remaining terms
+    if (nopen > 0 and j > 0 and m > t) {
+      theta = prune_threshold(ctx, nbest, uniqresp, inlen, hypcnt);
+      for (b=0; b<nb; b++) {
+	if (open[b] and
+	    count_bound(rest, wmax, m_buckets[b].m_seqlen, inlen, hypcnt) < theta) {
+	  open[b] = 0;
+	  nopen--;
+	}
+      }
+    }
+    if (nopen == nb) {
+      for (k=0; k<m; k++) {
+	l = m_order[postings[k]];
+	if (allowed.test(l)) ctx.m_accu.add(l, w);
+      }
+      rest -= w;
+      continue;
+    }
+    // walk the postings of open buckets, remember those of closed ones
+    closed.clear();
+    for (clen=0, lo=postings, b=0; b<nb and lo<postings+m; b++) {
+      lo = lower_bound(lo, postings + m, m_buckets[b].m_first);
+      hi = lower_bound(lo, postings + m, m_buckets[b].m_last);
+      if (open[b]) {
+	for (pos=lo; pos<hi; pos++) {
+	  l = m_order[*pos];
+	  if (allowed.test(l)) ctx.m_accu.add(l, w);
+	}
+      } else if (hi > lo) {
+	closed.push_back(make_pair(lo, hi));
+	clen += hi - lo;
+      }
+      lo = hi;
+    }
+    if (clen > 64 * t) {
+      // look up seen Q&A pairs of closed buckets in the postings list
+      for (k=0; k<t; k++) {
+	i = ctx.m_accu.touched(k);
+	if (i >= m_indexed or open[m_len2bucket[m_seqlens[i]]]) continue;
+	pos = lower_bound(postings, postings + m, m_rank[i]);
+	if (pos != postings + m and *pos == m_rank[i]) ctx.m_accu.add(i, w);
+      }
+    } else {
+      for (c=0; c<closed.size(); c++) {
+	for (pos=closed[c].first; pos<closed[c].second; pos++) {
+	  l = m_order[*pos];
+	  if (ctx.m_accu.count(l) > 0) ctx.m_accu.add(l, w);
+	}
+      }
+    }
+    rest -= w;
+  }
+}
+
+// postings of Q&A pairs added after make_index
+
+void QADB :: accumulate_added (UINT code, UINT weight, const CBitSet & allowed,
+			       QAContext & ctx) const
+{
+  UINT k, l, m;
+
+  if (code >= m_addindex.size()) return;
+  const vector<UINT> & added = m_addindex[code];
+  m = added.size();
+  for (k=0; k<m; k++) {
+    l = added[k];
+    if (allowed.test(l)) ctx.m_accu.add(l, weight);
+  }
+}
+
+// count^1.0001 (prefers higher match counts), table lookup for small counts
+
+inline double QADB :: count_weight (UINT cnt) const
+{
+  return (cnt < POWTAB_SIZE) ? m_powtab[cnt] : pow(static_cast<double>(cnt),1.0001);
+}
+
+// scoring kernel for the count-based match modes: scores all touched
+// Q&A pairs (all Q&A pairs for dense contexts) from their match counts,
+// per-example fields are read from m_seqlens / m_slots only
+
+void QADB :: score_counts (QAContext & ctx, float inlen, int hypcnt) const
+{
+  const UINT * seqlen = (m_seqlens.size() > 0) ? &m_seqlens[0] : NULL;
+  const UINT * slot = (m_slots.size() > 0) ? &m_slots[0] : NULL;
+  float * score = (ctx.m_score.size() > 0) ? &ctx.m_score[0] : NULL;
+  UBYTE * exact = (ctx.m_exact.size() > 0) ? &ctx.m_exact[0] : NULL;
+  UINT i, k, c, t;
+  float exlen, maxlen, s, total;
+
+  t = ctx.m_dense ? qadb_size() : ctx.m_accu.used();
+
+  switch(m_matchmode) {
+  case MATCH_MAXLEN:
+  case MATCH_KBEST:
+    for (k=0; k<t; k++) {
+      i = ctx.m_dense ? k : ctx.m_accu.touched(k);
+      c = ctx.m_accu.count(i);
+      exlen = static_cast<float>(seqlen[i] * hypcnt);
+      maxlen = (inlen > exlen) ? inlen : exlen;
+      // prefer higher match counts / longer examples (heuristic)
+      score[i] = count_weight(c) / maxlen;
+      exact[i] = (inlen == exlen && inlen == c);
+    }
+    break;
+  case MATCH_EXLEN:
+    for (k=0; k<t; k++) {
+      i = ctx.m_dense ? k : ctx.m_accu.touched(k);
+      c = ctx.m_accu.count(i);
+      exlen = static_cast<float>(seqlen[i] * hypcnt);
+      score[i] = static_cast<float>(c) / exlen;
+      exact[i] = (inlen == exlen && inlen == c);
+    }
+    break;
+  case MATCH_INLEN:
+    for (k=0; k<t; k++) {
+      i = ctx.m_dense ? k : ctx.m_accu.touched(k);
+      c = ctx.m_accu.count(i);
+      exlen = static_cast<float>(seqlen[i] * hypcnt);
+      score[i] = static_cast<float>(c) / inlen;
+      exact[i] = (inlen == exlen && inlen == c);
+    }
+    break;
+  case MATCH_BAYES:
+    total = static_cast<float>(m_remaining);
+    for (k=0; k<t; k++) {
+      i = ctx.m_dense ? k : ctx.m_accu.touched(k);
+      c = ctx.m_accu.count(i);
+      exlen = static_cast<float>(seqlen[i] * hypcnt);
+      maxlen = (inlen > exlen) ? inlen : exlen;
+      // experimental, response prior from the slot size
+      s = count_weight(c) / maxlen;
+      score[i] = s * (static_cast<float>(m_slotsize[slot[i]]) / total);
+      exact[i] = (inlen == exlen && inlen == c);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// score of a Q&A pair for a given match count (count-based match modes)
+
+float QADB :: count_score (UINT index, UINT cnt, float inlen, int hypcnt) const
+{
+  float exlen, maxlen;
+
+  exlen = static_cast<float>(m_seqlens[index] * hypcnt);
+  switch(m_matchmode) {
+  case MATCH_MAXLEN:
+    maxlen = (inlen > exlen) ? inlen : exlen;
+    return count_weight(cnt) / maxlen;
+  case MATCH_EXLEN:
+    return static_cast<float>(cnt) / exlen;
+  case MATCH_INLEN:
+    return static_cast<float>(cnt) / inlen;
+  default:
+    return 0.0;
+  }
+}
+
+// upper bound of the score of a Q&A pair of length seqlen matching
+// at most cnt terms, weight is the largest number of occurrences
+// of a query term
+
+float QADB :: count_bound (UINT cnt, UINT weight, UINT seqlen,
+			  float inlen, int hypcnt) const
+{
+  float exlen, maxlen;
+
+  // an example of length seqlen matches at most seqlen * weight terms
+  if (seqlen * weight < cnt) cnt = seqlen * weight;
+  exlen = static_cast<float>(seqlen * hypcnt);
+
+  switch(m_matchmode) {
+  case MATCH_MAXLEN:
+    maxlen = (inlen > exlen) ? inlen : exlen;
+    return count_weight(cnt) / maxlen;
+  case MATCH_EXLEN:
+    if (seqlen == 0) return 0.0;
+    return static_cast<float>(cnt) / exlen;
+  case MATCH_INLEN:
+    return static_cast<float>(cnt) / inlen;
+  default:
+    return 0.0;
+  }
+}
+
+// lowest score in the current n-best list based on partial match counts
+// (-1.0 as long as the list is not full)
+
+float QADB :: prune_threshold (QAContext & ctx, UINT nbest, bool uniqresp,
+			       float inlen, int hypcnt) const
+{
+  CTopList<float,UINT> toplist(nbest);
+  UINT i, k, s, t;
+  float score;
+
+  t = ctx.m_accu.used();
+  if (t < nbest) return -1.0;
+  if (uniqresp) prepare_slots(ctx);
+  for (k=0; k<t; k++) {
+    i = ctx.m_accu.touched(k);
+    score = count_score(i, ctx.m_accu.count(i), inlen, hypcnt);
+    if (uniqresp) {
+      s = m_slots[i];
+      if (ctx.m_slotbest[s] == NO_QAINDEX) {
+	ctx.m_slotbest[s] = i;
+	ctx.m_slotscore[s] = score;
+	ctx.m_topslots.push_back(s);
+      } else if (score > ctx.m_slotscore[s]) {
+	ctx.m_slotscore[s] = score;
+      }
+    } else {
+      toplist.push(score, i);
+    }
+  }
+  for (k=0; k<ctx.m_topslots.size(); k++) {
+    s = ctx.m_topslots[k];
+    toplist.push(ctx.m_slotscore[s], s);
+    ctx.m_slotbest[s] = NO_QAINDEX;
+  }
+  ctx.m_topslots.clear();
+  if (static_cast<UINT>(toplist.used()) < nbest) return -1.0;
+  toplist.front(&i, &score);
+
+  return score;
+}
+
+// n-best retrieval for all match modes using a bounded top list,
+// Q&A pairs without matching morpheme are not listed (count-based modes)
+
+UINT QADB :: retrieve_nbest (const char * query, UINT nbest, bool uniqresp,
+			     QAContext & ctx, vector<QAResult> & results) const
+{
+  QAQuery codes;
+
+  parse_query(query, codes);
+  return retrieve_nbest(codes, nbest, uniqresp, ctx, results);
+}
+
+UINT QADB :: retrieve_nbest (const vector<UINT> & codeseq, int hypcnt, UINT nbest,
+			     bool uniqresp, QAContext & ctx,
+			     vector<QAResult> & results) const
+{
+  QAQuery query;
+
+  query.assign(codeseq, hypcnt);
+  return retrieve_nbest(query, nbest, uniqresp, ctx, results);
+}
+
+UINT QADB :: retrieve_nbest (const QAQuery & query, UINT nbest, bool uniqresp,
+			     QAContext & ctx, vector<QAResult> & results) const
+{
+  vector<float> slotscore;
+  vector<UINT> slotindex;
+  vector<UINT> idents;
+  vector<float> scores;
+  vector<bool> slots;
+  vector<UINT> key;
+  const CBitSet * allowed = NULL;
+  QAResult result;
+  UINT i, j, k, n, s, limit;
+  float score;
+
+  ULONG start = timing_start();
+
+  results.clear();
+  if (nbest == 0 or qadb_size() == 0) return 0;
+  // the list never holds more than all responses or Q&A pairs
+  limit = (m_matchmode == MATCH_TFIDF or m_matchmode == MATCH_KBEST) ?
+    m_residlist.size() : qadb_size();
+  if (nbest > limit) nbest = limit;
+  CTopList<float,UINT> toplist(nbest);
+
+  ctx.m_acctime = 0;
+  if (m_cache.capacity() > 0 and not ctx.m_exhaustive and ctx.m_mask == NULL) {
+    key = cache_key(query, nbest, uniqresp);
+    if (m_cache.lookup(key, m_generation, results)) {
+      ctx.prepare(qadb_size(), false);
+      timing_add(TIME_SCORE, timing_since(start));
+      return results.size();
+    }
+  }
+
+  switch(m_matchmode) {
+  case MATCH_TFIDF:
+    // response-level scores from the tf-idf matrix
+    m_tfidfmatrix.lookup_all(query.codes(), query.weights(), idents, scores);
+    // masked queries skip responses without allowed example
+    if (ctx.m_mask != NULL) allowed_slots(ctx, slots);
+    n = idents.size();
+    for (j=0; j<n; j++) {
+      if (ctx.m_mask != NULL and not slots[m_resid2slot.find(idents[j])->second])
+	continue;
+      toplist.push(scores[j], j);
+    }
+    while (toplist.pop(&j, &score)) {
+      result.m_index = NO_QAINDEX;
+      result.m_resid = idents[j];
+      result.m_score = score;
+      result.m_exact = false;
+      results.push_back(result);
+    }
+    break;
+  case MATCH_KBEST:
+    // response-level scores from the example scores
+    retrieve_topk(query, 1, false, ctx);
+    kbest_scores(ctx, slotscore, slotindex);
+    // only responses with a usable Q&A pair are listed
+    if (ctx.m_mask != NULL) allowed_slots(ctx, slots);
+    n = m_residlist.size();
+    for (j=0; j<n; j++) {
+      if ((ctx.m_mask != NULL) ? not slots[j] : m_slotactive[j] == 0) continue;
+      toplist.push(slotscore[j], j);
+    }
+    while (toplist.pop(&j, &score)) {
+      result.m_resid = m_residlist[j];
+      result.m_index = slotindex[j];
+      result.m_score = score;
+      result.m_exact = false;
+      results.push_back(result);
+    }
+    break;
+  default:
+    // example-level scores
+    retrieve_topk(query, nbest, uniqresp, ctx);
+    if (uniqresp) prepare_slots(ctx);
+    // dense contexts (MATCH_CONF) score all Q&A pairs,
+    // only usable ones are listed
+    if (ctx.m_dense) allowed = &candidates(ctx);
+    n = ctx.m_dense ? qadb_size() : ctx.m_accu.used();
+    for (k=0; k<n; k++) {
+      i = ctx.m_dense ? k : ctx.m_accu.touched(k);
+      if (ctx.m_dense and not allowed->test(i)) continue;
+      if (uniqresp) {
+	// keep only best example per response slot
+	s = m_slots[i];
+	j = ctx.m_slotbest[s];
+	if (j == NO_QAINDEX) {
+	  ctx.m_slotbest[s] = i;
+	  ctx.m_topslots.push_back(s);
+	} else if (ctx.m_score[i] > ctx.m_score[j] or
+		   (ctx.m_score[i] == ctx.m_score[j] and i < j)) {
+	  ctx.m_slotbest[s] = i;
+	}
+      } else {
+	toplist.push(ctx.m_score[i], i);
+      }
+    }
+    for (k=0; k<ctx.m_topslots.size(); k++) {
+      s = ctx.m_topslots[k];
+      i = ctx.m_slotbest[s];
+      toplist.push(ctx.m_score[i], i);
+      ctx.m_slotbest[s] = NO_QAINDEX;
+    }
+    ctx.m_topslots.clear();
+    while (toplist.pop(&i, &score)) {
+      result.m_index = i;
+      result.m_resid = m_resids[i];
+      result.m_score = score;
+      result.m_exact = ctx.exact(i);
+      results.push_back(result);
+    }
+    break;
+  }
+
+  // top list pops worst first
+  reverse(results.begin(), results.end());
+  if (key.size() > 0) m_cache.insert(key, m_generation, results);
+  timing_add(TIME_SCORE, timing_since(start) - ctx.m_acctime);
+
+  return results.size();
+}
+
+void QADB :: print_nbestresid (Sentence & query, int hypcnt, int nbest)
+{
+  QAContext context;
+  vector<QAResult> results;
+  map<string,UINT> unknown;
+  UINT i, n;
+
+  n = retrieve_nbest(sent2codes(query, unknown), hypcnt, nbest, true, context, results);
+  for (i=0; i<n; i++) {
+    if (i==0)
+      cout << results[i].m_resid << ":" << results[i].m_score;
+    else
+      cout << "/" << results[i].m_resid << ":" << results[i].m_score;
+  }
+  cout << endl;
+}
+
+// tf-idf-matrix-based retrieve function
+
+QAPair QADB :: retrieve_tfidf (Sentence & query)
+{
+  QAResult result;
+  QAQuery codes;
+  QAPair pair;
+  map<string,UINT> unknown;
+  
+  // pair.m_morphseq = query;
+  pair.m_codeseq = sent2codes(query, unknown);
+  codes.assign(pair.m_codeseq, 1);
+  result = retrieve_tfidf(codes, m_context);
+
+  pair.m_score  = result.m_score;
+  pair.m_resid  = result.m_resid;
+  pair.m_index  = 0;
+  pair.m_active = true;
+  pair.m_exact  = false;
+  pair.m_question = string("*");
+  pair.m_response = response(result.m_resid);
+  
+  return pair;
+}
+
+QAResult QADB :: retrieve_tfidf (const QAQuery & query, QAContext & ctx) const
+{
+  vector<UINT> idents;
+  vector<float> scores;
+  vector<bool> slots;
+  map<UINT,UINT>::const_iterator it;
+  QAResult result;
+  UINT j, n;
+  bool found = false;
+
+  result.m_index = NO_QAINDEX;
+  result.m_exact = false;
+  if (ctx.m_mask == NULL) {
+    result.m_resid = m_tfidfmatrix.lookup(query.codes(), query.weights(), &result.m_score);
+    return result;
+  }
+
+  // masked query: best of the responses with an allowed example
+  // (first allowed response if none matches, as lookup does)
+  allowed_slots(ctx, slots);
+  m_tfidfmatrix.lookup_all(query.codes(), query.weights(), idents, scores);
+  result.m_resid = idents.empty() ? 0 : idents.front();
+  result.m_score = 0.0;
+  n = idents.size();
+  for (j=0; j<n; j++) {
+    it = m_resid2slot.find(idents[j]);
+    if (it == m_resid2slot.end() or not slots[it->second]) continue;
+    if (not found or scores[j] > result.m_score) {
+      result.m_resid = idents[j];
+      result.m_score = scores[j];
+      found = true;
+    }
+  }
+
+  return result;
+}
+
+// helper functions
 
 QAPair QADB :: string2qapair(const char * input)
 {
@@ -1566,9 +2594,451 @@ inline UINT QADB :: morph2code(string morph)
   }
 }
 
+// analyze (n-best) query string without modifying the database
+// a hypothesis may be followed by a tab and an integer weight
+
+bool QADB :: parse_query(const char * input, QAQuery & query) const
+{
+  vector<string> hypvec;
+  vector<UINT>   codes;
+  map<string,UINT> unknown;
+  Sentence       morphseq;
+  string         hyp;
+  UINT           i, weight, total;
+  string::size_type tab;
+  const char *   text;
+  char *         rest;
+  long           value;
+  ULONG start, parsetime = 0, codetime = 0;
+
+  query.clear();
+  hypvec = split(input,'|');
+  for (i=0, total=0; i<hypvec.size(); i++) {
+    hyp = hypvec[i];
+    weight = 1;
+    tab = hyp.rfind('\t');
+    if (tab != string::npos) {
+      text  = hyp.c_str() + tab + 1;
+      value = strtol(text, &rest, 10);
+      if (rest == text or *rest != '\0' or value < 0 or value > MAX_HYPWEIGHT) {
+	query.clear();
+	return false;
+      }
+      weight = static_cast<UINT>(value);
+      hyp.erase(tab);
+    }
+    total += weight;
+    if (weight == 0 or (m_matchmode == MATCH_CONF and i > 0)) continue;
+    start = timing_start();
+    morphseq = parse_sentence(hyp.c_str());
+    parsetime += timing_since(start);
+    start = timing_start();
+    if (m_matchmode != MATCH_TFIDF and m_matchmode != MATCH_CONF)
+      morphseq = validate_sentence(morphseq);
+    codes = sent2codes(morphseq, unknown);
+    codetime += timing_since(start);
+    // use only single best recognition hypothesis
+    // for confusion probability based scoring
+    if (m_matchmode == MATCH_CONF) {
+      query.add_hypothesis(codes);
+    } else {
+      query.add_hypothesis(codes, weight);
+    }
+  }
+  // keep the total weight for the length normalization
+  if (m_matchmode == MATCH_CONF) {
+    codes = query.codes();
+    query.assign(codes, total);
+  } else {
+    query.finish();
+  }
+  timing_add(TIME_PARSE, parsetime);
+  timing_add(TIME_CODES, codetime);
+  return true;
+}
+
+int QADB :: parse_query(const char * input, vector<UINT> & codeseq) const
+{
+  QAQuery query;
+
+  parse_query(input, query);
+  codeseq = query.codes();
+
+  return query.hypcnt();
+}
+
+// unknown morphemes get query-local codes above m_maxcode
+// (distinct per surface form, as if registered by morph2code)
+
+vector<UINT> QADB :: sent2codes(const Sentence & sent, map<string,UINT> & unknown) const
+{
+  UINT i;
+  UINT n = sent.size();
+  vector<UINT> codeseq(n);
+
+  for (i=0; i<n; i++)
+    codeseq[i] = find_code(sent[i].m_origin, unknown);
+
+  return codeseq;
+}
+
+UINT QADB :: find_code(const string & morph, map<string,UINT> & unknown) const
+{
+  map<string,UINT>::const_iterator it = m_morph2code.find(morph);
+  UINT code;
+
+  if (it != m_morph2code.end() and it->second != 0) return it->second;
+  it = unknown.find(morph);
+  if (it != unknown.end()) return it->second;
+  code = m_maxcode + 1 + unknown.size();
+  unknown[morph] = code;
+  return code;
+}
+
+string QADB :: response(UINT resid) const
+{
+  map<UINT,Response>::const_iterator it = m_resid2response.find(resid);
+  return (it != m_resid2response.end()) ? it->second.m_message : string("");
+}
+
+// per-slot scratch memory of a query context
+
+void QADB :: prepare_slots (QAContext & ctx) const
+{
+  if (ctx.m_slotbest.size() < m_residlist.size()) {
+    ctx.m_slotbest.resize(m_residlist.size(), NO_QAINDEX);
+    ctx.m_slotscore.resize(m_residlist.size());
+  }
+}
+
+float QADB :: conf_prob(UINT ref, UINT hyp) const
+{
+  map< UINT, map<UINT,float> >::const_iterator it = m_cftab_cp.find(ref);
+  map<UINT,float>::const_iterator jt;
+
+  if (it == m_cftab_cp.end()) return 0.0;
+  jt = it->second.find(hyp);
+  return (jt != it->second.end()) ? jt->second : 0.0;
+}
+
+// usable Q&A pairs: active ones, restricted by the query mask
+// (word-wide AND, once per query)
+
+const CBitSet & QADB :: candidates (QAContext & ctx) const
+{
+  if (ctx.m_mask == NULL) return m_actives;
+  ctx.m_allowed.intersect(m_actives, *ctx.m_mask);
+  return ctx.m_allowed;
+}
+
+// response slots with at least one usable Q&A pair
+
+void QADB :: allowed_slots (QAContext & ctx, vector<bool> & slots) const
+{
+  const CBitSet & allowed = candidates(ctx);
+  UINT i, n = qadb_size();
+
+  slots.assign(m_residlist.size(), false);
+  for (i=0; i<n; i++) if (allowed.test(i)) slots[m_slots[i]] = true;
+}
+
+// mask of all Q&A pairs with one of the given response IDs
+// (e.g. responses allowed in the current dialogue state)
+
+void QADB :: response_mask (const vector<UINT> & resids, CBitSet & mask) const
+{
+  vector<UINT> allowed(resids);
+  UINT i, n;
+
+  sort(allowed.begin(), allowed.end());
+  n = qadb_size();
+  mask.resize(0);
+  mask.resize(n, false);
+  for (i=0; i<n; i++) {
+    if (binary_search(allowed.begin(), allowed.end(), m_resids[i])) mask.set(i);
+  }
+}
+
+// cache key: retrieval parameters followed by the query codes,
+// sorted unless the match mode depends on the morpheme order
+
+vector<UINT> QADB :: cache_key (const QAQuery & query, UINT nbest,
+				bool uniqresp) const
+{
+  const vector<QueryTerm> & terms = query.terms();
+  vector<UINT> key;
+  UINT j;
+
+  key.reserve(2 * terms.size() + 3);
+  key.push_back(static_cast<UINT>(query.hypcnt()));
+  key.push_back(nbest);
+  key.push_back(uniqresp ? 1 : 0);
+  if (m_matchmode == MATCH_CONF) {
+    key.insert(key.end(), query.codes().begin(), query.codes().end());
+  } else {
+    for (j=0; j<terms.size(); j++) {
+      key.push_back(terms[j].m_code);
+      key.push_back(terms[j].m_weight);
+    }
+  }
+
+  return key;
+}
+
+// query result cache
+
+QACache :: QACache()
+  : m_capacity(0), m_generation(0), m_hits(0), m_misses(0)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+QACache :: ~QACache()
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+void QACache :: resize(UINT capacity)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_capacity = capacity;
+  while (m_entries.size() > m_capacity) {
+    m_lookup.erase(m_entries.back().first);
+    m_entries.pop_back();
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void QACache :: clear(void)
+{
+  pthread_mutex_lock(&m_mutex);
+  m_entries.clear();
+  m_lookup.clear();
+  pthread_mutex_unlock(&m_mutex);
+}
+
+bool QACache :: lookup(const vector<UINT> & key, UINT generation,
+		       vector<QAResult> & results)
+{
+  map< vector<UINT>, EntryList::iterator >::iterator it;
+  bool found = false;
+
+  pthread_mutex_lock(&m_mutex);
+  drop(generation);
+  it = m_lookup.find(key);
+  if (it != m_lookup.end()) {
+    // move entry to the front
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    results = it->second->second;
+    m_hits++;
+    found = true;
+  } else {
+    m_misses++;
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  return found;
+}
+
+void QACache :: insert(const vector<UINT> & key, UINT generation,
+		       const vector<QAResult> & results)
+{
+  pthread_mutex_lock(&m_mutex);
+  drop(generation);
+  if (m_capacity > 0 and m_lookup.find(key) == m_lookup.end()) {
+    if (m_entries.size() >= m_capacity) {
+      // evict least recently used entry
+      m_lookup.erase(m_entries.back().first);
+      m_entries.pop_back();
+    }
+    m_entries.push_front(make_pair(key, results));
+    m_lookup[key] = m_entries.begin();
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// forget all entries of older database generations (mutex held)
+
+void QACache :: drop(UINT generation)
+{
+  if (generation != m_generation) {
+    m_entries.clear();
+    m_lookup.clear();
+    m_generation = generation;
+  }
+}
+
+// double-buffered database
+
+QAHandle :: QAHandle(QADB * db)
+  : m_current(db), m_generation(1), m_loading(false), m_loaded(false),
+    m_done(false), m_loader(NULL), m_arg(NULL)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  m_users[db] = 0;
+}
+
+QAHandle :: ~QAHandle()
+{
+  map< QADB *, UINT >::iterator it;
+
+  wait();
+  for (it=m_users.begin(); it!=m_users.end(); it++) delete it->first;
+  pthread_mutex_destroy(&m_mutex);
+}
+
+QADB * QAHandle :: acquire(void)
+{
+  QADB * db;
+
+  pthread_mutex_lock(&m_mutex);
+  db = m_current;
+  m_users[db] += 1;
+  pthread_mutex_unlock(&m_mutex);
+
+  return db;
+}
+
+void QAHandle :: release(QADB * db)
+{
+  map< QADB *, UINT >::iterator it;
+  QADB * old = NULL;
+
+  pthread_mutex_lock(&m_mutex);
+  it = m_users.find(db);
+  if (it != m_users.end()) {
+    it->second -= 1;
+    // last query on a replaced database
+    if (it->second == 0 and db != m_current) {
+      old = db;
+      m_users.erase(it);
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  if (old) delete old;
+}
+
+void QAHandle :: swap(QADB * db)
+{
+  map< QADB *, UINT >::iterator it;
+  QADB * old = NULL;
+
+  pthread_mutex_lock(&m_mutex);
+  it = m_users.find(m_current);
+  if (it->second == 0) {
+    old = m_current;
+    m_users.erase(it);
+  }
+  m_current = db;
+  m_users[db] = 0;
+  m_generation++;
+  pthread_mutex_unlock(&m_mutex);
+
+  if (old) delete old;
+}
+
+void * QAHandle :: reload_worker(void * arg)
+{
+  QAHandle * handle = static_cast<QAHandle *>(arg);
+  QADB * db;
+
+  db = handle->m_loader(handle->m_arg);
+  if (db != NULL) handle->swap(db);
+  pthread_mutex_lock(&handle->m_mutex);
+  handle->m_loaded = (db != NULL);
+  handle->m_done   = true;
+  pthread_mutex_unlock(&handle->m_mutex);
+
+  return NULL;
+}
+
+bool QAHandle :: reload(QALoader loader, void * arg)
+{
+  bool busy;
+
+  pthread_mutex_lock(&m_mutex);
+  busy = m_loading and not m_done;
+  pthread_mutex_unlock(&m_mutex);
+  if (busy) return false;
+
+  wait();
+  m_loader  = loader;
+  m_arg     = arg;
+  m_loaded  = false;
+  m_done    = false;
+  m_loading = (pthread_create(&m_thread, NULL, reload_worker, this) == 0);
+
+  return m_loading;
+}
+
+bool QAHandle :: wait(void)
+{
+  if (m_loading) {
+    pthread_join(m_thread, NULL);
+    m_loading = false;
+  }
+  return m_loaded;
+}
+
+// prepare scratch memory of a query context for n Q&A pairs
+
+void QAContext :: prepare(UINT n, bool dense)
+{
+  m_accu.clear();
+  m_accu.resize(n);
+  if (m_score.size() < n) {
+    m_score.resize(n);
+    m_exact.resize(n);
+  }
+  m_dense = dense;
+}
+
+// add hypothesis as if it occurred weight times in the n-best list
+
+void QAQuery :: add_hypothesis(const vector<UINT> & codes, UINT weight)
+{
+  if (weight == 0) return;
+  m_codes.insert(m_codes.end(), codes.begin(), codes.end());
+  m_weights.insert(m_weights.end(), codes.size(), weight);
+  m_length += weight * codes.size();
+  m_hypcnt += weight;
+}
+
+void QAQuery :: assign(const vector<UINT> & codeseq, int hypcnt)
+{
+  m_codes  = codeseq;
+  m_weights.assign(codeseq.size(), 1);
+  m_length = codeseq.size();
+  m_hypcnt = hypcnt;
+  merge();
+}
+
+// distinct terms with their number of occurrences
+
+void QAQuery :: merge()
+{
+  vector< pair<UINT,UINT> > codes;
+  QueryTerm term;
+  UINT j, k, n;
+
+  n = m_codes.size();
+  codes.resize(n);
+  for (j=0; j<n; j++) codes[j] = make_pair(m_codes[j], m_weights[j]);
+  sort(codes.begin(), codes.end());
+  m_terms.clear();
+  for (j=0; j<n; j=k) {
+    term.m_code   = codes[j].first;
+    term.m_weight = 0;
+    term.m_df     = 0;
+    for (k=j; k<n and codes[k].first == codes[j].first; k++) term.m_weight += codes[k].second;
+    m_terms.push_back(term);
+  }
+}
+
 // avoid double matching of the same morpheme
 
-Sentence & QADB :: validate_sentence(Sentence & sent)
+Sentence & QADB :: validate_sentence(Sentence & sent) const
 {
   UINT i,n;
   map<string,UINT> morphcnt;
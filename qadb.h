@@ -18,8 +18,21 @@
 #include "util.h"
 #include "heap.h"
 #include "irt.h"
+#include "accu.h"
+#include "postings.h"
+#include "bitset.h"
+#include "timing.h"
+
+#include <pthread.h>
 
 #define MAX_BUFLEN 65536
+#define NO_QAINDEX UINT(-1)
+#define POWTAB_SIZE 256
+#define KBEST_SIZE 5
+// largest weight of a query hypothesis
+#define MAX_HYPWEIGHT 100
+#define IMAGE_MAGIC "QADB-IMAGE"
+#define IMAGE_VERSION 2
 
 typedef struct {
   UINT          m_ident;
@@ -43,6 +56,166 @@ typedef struct {
   Sentence      m_morphseq; // morpheme code sequence
 } QAPair;
 
+// text and morphology of a stored Q&A pair (cold data,
+// only read for printing, saving and alignment)
+typedef struct {
+  int           m_hypcnt;   // number of input hypothesis
+  string        m_question; // example question
+  string        m_response; // response sentence
+  vector<UINT>  m_codeseq;  // internal morpheme code sequence
+  Sentence      m_morphseq; // morpheme code sequence
+} QAText;
+
+// result of a retrieval, refers back into the database
+typedef struct {
+  UINT          m_index;    // Q&A pair internal index (best example)
+  UINT          m_resid;    // response ID
+  float         m_score;    // match score
+  bool          m_exact;    // exact match with input query
+} QAResult;
+
+// distinct query term with its number of occurrences and postings size
+typedef struct {
+  UINT m_code;
+  UINT m_weight;
+  UINT m_df;
+} QueryTerm;
+
+// (n-best) query: the hypotheses are merged into distinct weighted
+// terms, so that each term is looked up only once. a hypothesis of
+// weight w counts as w identical hypotheses (its codes are kept once)
+class QAQuery
+{
+ public:
+  QAQuery() : m_length(0), m_hypcnt(0) {}
+  virtual ~QAQuery() {}
+
+  void clear() {
+    m_codes.clear(); m_weights.clear(); m_terms.clear();
+    m_length = 0; m_hypcnt = 0;
+  }
+  // hypotheses are collected until finish() merges their terms
+  void add_hypothesis(const vector<UINT> & codes, UINT weight = 1);
+  void finish() { merge(); }
+  // concatenated code sequence of hypcnt hypotheses
+  void assign(const vector<UINT> & codeseq, int hypcnt);
+
+  // distinct terms sorted by code (m_df is not set)
+  const vector<QueryTerm> & terms() const { return m_terms; }
+  // all codes in input order and the weight of their hypothesis
+  const vector<UINT> & codes() const { return m_codes; }
+  const vector<UINT> & weights() const { return m_weights; }
+  // number of codes, weighted hypotheses counted w times
+  UINT length() const { return m_length; }
+  int hypcnt() const { return m_hypcnt; }
+
+ private:
+  void merge();
+
+  vector<UINT>      m_codes;
+  vector<UINT>      m_weights;
+  vector<QueryTerm> m_terms;
+  UINT              m_length;
+  int               m_hypcnt;
+};
+
+// per-query scratch memory owned by the caller
+// one context must not be used by two retrievals at the same time
+class QAContext
+{
+  friend class QADB;
+ public:
+  QAContext() : m_mask(NULL), m_dense(false), m_exhaustive(false), m_acctime(0) {}
+  virtual ~QAContext() {}
+
+  // score all matching Q&A pairs completely (no pruning),
+  // otherwise only the scores of the top candidates are reliable
+  void set_exhaustive(bool on) { m_exhaustive = on; }
+  // retrieve only Q&A pairs whose bit is set in mask (NULL: all),
+  // the mask is owned by the caller. MATCH_TFIDF scores responses,
+  // it skips the responses without an allowed Q&A pair
+  void set_mask(const CBitSet * mask) { m_mask = mask; }
+
+  // match score and exact flag of Q&A pair for the last query
+  float score(UINT index) const {
+    return (m_dense or m_accu.count(index) > 0) ? m_score[index] : 0.0;
+  }
+  bool exact(UINT index) const {
+    return (not m_dense and m_accu.count(index) > 0) ? m_exact[index] : false;
+  }
+
+ private:
+  void prepare(UINT n, bool dense);
+
+  // match counters of touched Q&A pairs
+  CAccumulator  m_accu;
+  // decoded postings list (compressed index)
+  vector<UINT>  m_postbuf;
+  // match scores (all Q&A pairs if dense, touched ones otherwise)
+  vector<float> m_score;
+  vector<UBYTE> m_exact;
+  // best KBEST_SIZE example scores per response slot (MATCH_KBEST)
+  vector<float> m_topscore;
+  vector<UINT>  m_topindex;
+  vector<UBYTE> m_topcount;
+  // best example and its score per response slot (unique responses)
+  vector<UINT>  m_slotbest;
+  vector<float> m_slotscore;
+  // response slots in use
+  vector<UINT>  m_topslots;
+  // query mask and its intersection with the usable Q&A pairs
+  const CBitSet * m_mask;
+  CBitSet       m_allowed;
+  bool          m_dense;
+  bool          m_exhaustive;
+  // postings walk time of the current query (timing only)
+  ULONG         m_acctime;
+};
+
+// bounded LRU cache of retrieval results, keyed by normalized query
+// (code sequence and retrieval parameters), shared between threads.
+// entries computed for another database generation are dropped
+class QACache
+{
+ public:
+  QACache();
+  virtual ~QACache();
+
+  // maximum number of entries (0: cache disabled)
+  void resize(UINT capacity);
+  UINT capacity(void) const { return m_capacity; }
+  void clear(void);
+
+  bool lookup(const vector<UINT> & key, UINT generation,
+	      vector<QAResult> & results);
+  void insert(const vector<UINT> & key, UINT generation,
+	      const vector<QAResult> & results);
+
+  ULONG hits(void) const { return m_hits; }
+  ULONG misses(void) const { return m_misses; }
+
+ private:
+  typedef list< pair< vector<UINT>, vector<QAResult> > > EntryList;
+
+  void drop(UINT generation);
+
+  // entries, most recently used first
+  EntryList                                 m_entries;
+  map< vector<UINT>, EntryList::iterator >  m_lookup;
+  UINT            m_capacity;
+  UINT            m_generation;
+  ULONG           m_hits;
+  ULONG           m_misses;
+  pthread_mutex_t m_mutex;
+};
+
+// range of index positions holding the examples of one length
+typedef struct {
+  UINT          m_seqlen;   // length of example questions
+  UINT          m_first;    // first position
+  UINT          m_last;     // one past the last position
+} LengthBucket;
+
 typedef enum { MATCH_EXLEN, MATCH_INLEN, MATCH_MAXLEN,
 	       MATCH_CONF, MATCH_TFIDF, MATCH_BAYES, MATCH_KBEST } MatchMode;
 
@@ -50,7 +223,10 @@ class QADB
 {
  public:
   QADB(string qadbfile, string respfile, UINT heapsize,
-       MatchMode mm, SimOp simop);
+       MatchMode mm, SimOp simop, int threads = 1);
+  // database from compiled image (see compile)
+  QADB(string imagefile, UINT heapsize,
+       MatchMode mm, SimOp simop, int threads = 1);
   virtual ~QADB() {}
 
   // methods to load or save Q&A Database
@@ -58,6 +234,27 @@ class QADB
   bool load_examples(string file);
   bool save_examples(string file);
 
+  // compiled image: responses, lexicon, analyzed examples and
+  // postings. the image is mapped read-only, so that its postings are
+  // used in place and shared by all processes serving the same image.
+  // loading still derives the length buckets, the exact match table,
+  // the slot tf-vectors and (MATCH_TFIDF) the tf-idf matrix from the
+  // examples, in time linear in the database size
+  bool compile(string file);
+  static bool is_image(string file);
+
+  // change the database without a full reindex (not while retrieving):
+  // new examples are analyzed and appended, their postings are kept in
+  // a small extra index until the next make_index. removed examples
+  // keep their index, but are never used again
+  UINT add_example(UINT resid, const char * question);
+  bool remove_example(UINT index);
+
+  // make index (morpheme to response ID mapping) for fast matching
+  // make term-frequency inverse document-frequency matrix
+  // (done by loading, needed only to fold in added examples early)
+  void make_index(void);
+
   // load vali question set
   bool load_validata(istream * infile);
 
@@ -68,12 +265,28 @@ class QADB
   bool load_stoplist(string file);
   void save_stoplist(string file);
 
+  // cache retrieval results of the reentrant retrieval functions
+  // for up to size queries (0: no caching)
+  void set_cache(UINT size) { m_cache.resize(size); }
+  // store postings lists compressed (smaller index, slower lookup)
+  void set_compressed_index(bool on) { m_index.set_compressed(on); }
+  ULONG index_bytes() const { return m_index.bytes(); }
+  ULONG cache_hits(void) const { return m_cache.hits(); }
+  ULONG cache_misses(void) const { return m_cache.misses(); }
+
+  // false if a database file could not be read (or was damaged)
+  bool loaded(void) const { return m_loaded; }
   // return number of Q&A pairs loaded
-  UINT qadb_size(void) { return m_qaset.size(); }
+  UINT qadb_size(void) const { return m_resids.size(); }
   // return number of distinct response sentences loaded
-  UINT resp_size(void) { return m_resid2response.size(); }
+  UINT resp_size(void) const { return m_resid2response.size(); }
   // return number of distinct morphemes
-  UINT morph_cnt(void) { return m_maxcode; }
+  UINT morph_cnt(void) const { return m_maxcode; }
+  // access Q&A pair by internal index
+  QAPair qapair(UINT index) const;
+  const QAText & qatext(UINT index) const { return m_qatext[index]; }
+  // response message for response ID
+  string response(UINT resid) const;
 
   // LOO optimization of Q&A database using validation data set
   void valiopt(void);
@@ -96,6 +309,30 @@ class QADB
   QAPair retrieve(Sentence & query, int hypcnt = 1);
   QAPair retrieve_tfidf(Sentence & query);
 
+  // reentrant retrieval: the database is not modified,
+  // scores are written into the caller-owned context
+  QAResult retrieve(const char * query, QAContext & ctx) const;
+  QAResult retrieve(const vector<UINT> & codeseq, int hypcnt,
+		    QAContext & ctx) const;
+  QAResult retrieve(const QAQuery & query, QAContext & ctx) const;
+  // reentrant n-best retrieval (best first), returns number of results
+  // uniqresp: list each response ID only once (with its best example)
+  UINT retrieve_nbest(const char * query, UINT nbest, bool uniqresp,
+		      QAContext & ctx, vector<QAResult> & results) const;
+  UINT retrieve_nbest(const vector<UINT> & codeseq, int hypcnt, UINT nbest,
+		      bool uniqresp, QAContext & ctx,
+		      vector<QAResult> & results) const;
+  UINT retrieve_nbest(const QAQuery & query, UINT nbest, bool uniqresp,
+		      QAContext & ctx, vector<QAResult> & results) const;
+  // analyze query string into (n-best) code sequence, returns hypcnt
+  int parse_query(const char * input, vector<UINT> & codeseq) const;
+  // same as weighted terms: "<HYP> [<WEIGHT>]|<HYP> [<WEIGHT>]|...",
+  // a weight which is not a number up to MAX_HYPWEIGHT makes the
+  // query empty (no match) and returns false
+  bool parse_query(const char * input, QAQuery & query) const;
+  // mask of all Q&A pairs with one of the given response IDs
+  void response_mask(const vector<UINT> & resids, CBitSet & mask) const;
+
   // output n-best Q&A pairs for given query
   void print_nbestresid(const char * query, int nbest = 10);
   void print_nbestresid(string & query, int nbest = 10) { print_nbestresid(query.c_str(), nbest); }
@@ -106,42 +343,119 @@ class QADB
 
  protected:
   // same surface from of morphemes in same sentence -> discernment
-  Sentence & validate_sentence(Sentence & sent);
+  Sentence & validate_sentence(Sentence & sent) const;
   // convert text-based kanji morphemes into number codes
   vector<UINT> sent2codeseq(Sentence & sent);
   UINT morph2code(string morph);
+  // same without registering unknown morphemes (query-local codes)
+  vector<UINT> sent2codes(const Sentence & sent, map<string,UINT> & unknown) const;
+  UINT find_code(const string & morph, map<string,UINT> & unknown) const;
   string code2morph(UINT code) { return m_code2morph[code]; }
 
  private:
-  // make index (morpheme to response ID mapping) for fast matching
-  // make term-frequency inverse document-frequency matrix
-  void make_index(void);
+  bool load_image(string file);
+  void make_buckets(void);
+  void make_tables(void);
+  void make_tfidf(void);
+  void update_tfidf(UINT slot);
+  void add_qapair(const QAPair & pair);
+  // change usable Q&A pairs (invalidates cached results)
+  void set_active(UINT index, bool active);
+  vector<UINT> cache_key(const QAQuery & query, UINT nbest,
+			 bool uniqresp) const;
   QAPair string2qapair(const char * input);
+  QAResult retrieve_tfidf(const QAQuery & query, QAContext & ctx) const;
+  QAResult retrieve_topk(const QAQuery & query, UINT nbest,
+			 bool uniqresp, QAContext & ctx) const;
+  // postings walk with upper-bound pruning (count-based match modes)
+  void accumulate(const QAQuery & query, UINT nbest, bool uniqresp,
+		  const CBitSet & allowed, QAContext & ctx) const;
+  void accumulate_added(UINT code, UINT weight, const CBitSet & allowed,
+			QAContext & ctx) const;
+  // usable Q&A pairs for a query (active and not masked)
+  const CBitSet & candidates(QAContext & ctx) const;
+  void allowed_slots(QAContext & ctx, vector<bool> & slots) const;
+  // answer verbatim repeats of example questions from m_exactindex
+  bool exact_match(const QAQuery & query, QAContext & ctx,
+		   QAResult & result) const;
+  UINT code_hash(const vector<UINT> & codes) const;
+  void score_counts(QAContext & ctx, float inlen, int hypcnt) const;
+  float count_score(UINT index, UINT cnt, float inlen, int hypcnt) const;
+  double count_weight(UINT cnt) const;
+  float count_bound(UINT cnt, UINT weight, UINT seqlen,
+		    float inlen, int hypcnt) const;
+  float prune_threshold(QAContext & ctx, UINT nbest, bool uniqresp,
+			float inlen, int hypcnt) const;
+  UINT kbest_scores(QAContext & ctx, vector<float> & slotscore,
+		    vector<UINT> & slotindex) const;
+  // lookup without creating table entries
+  float conf_prob(UINT ref, UINT hyp) const;
+  void prepare_slots(QAContext & ctx) const;
 
-  // mapping from morpheme (as text) to Q&A indices
-  map< string, vector<UINT> >       m_morph2indexlist;
-  // mapping from morpheme (as code) to Q&A indices
-  map< UINT, vector<UINT> >         m_code2indexlist;
+  // mapping from morpheme (as code) to index positions
+  CPostingIndex                     m_index;
+  // compiled image in use (postings may point into it)
+  CImageReader                      m_image;
+  // database files were read completely
+  bool                              m_loaded;
+  // postings of Q&A pairs added after make_index (Q&A indices),
+  // the first m_indexed Q&A pairs are covered by m_index
+  vector< vector<UINT> >            m_addindex;
+  UINT                              m_indexed;
+  // index positions are sorted by example length (length buckets):
+  // position -> Q&A index, Q&A index -> position
+  vector< UINT >                    m_order;
+  vector< UINT >                    m_rank;
+  vector< LengthBucket >            m_buckets;
+  // example length -> length bucket
+  vector< UINT >                    m_len2bucket;
+  // hash of sorted code sequence -> indexed Q&A pairs (ascending)
+  __gnu_cxx::hash_map< UINT, vector<UINT> > m_exactindex;
+  // retrieval result cache, m_generation counts changes
+  // of the database which affect retrieval results
+  mutable QACache                   m_cache;
+  UINT                              m_generation;
+  // count^1.0001 for small match counts
+  double                            m_powtab[POWTAB_SIZE];
   // mapping from morpheme text to morpheme code
   map< string, UINT >               m_morph2code;
   map< UINT, string >               m_code2morph;
-  // mapping from response ID to response object
+  // mapping from response ID to response object (only for I/O)
   map< UINT, Response >             m_resid2response;
-  // mapping from response ID to response prior
-  map< UINT, float >                m_resid2prior;
-  // mapping from response ID to term-frequency vector
-  map< UINT, CTermVector<UINT> >    m_resid2tfvector;
+  // term-frequency vector per response slot
+  vector< CTermVector<UINT> >       m_slottfvector;
   // term-frequency inverse document-frequency matrix
   CTermDocuMatrix<UINT>             m_tfidfmatrix;
 
   // current maximum morpheme code number
   UINT              m_maxcode;
-  // set of all Q&A pairs loaded
-  vector< QAPair >  m_qaset;
+  // set of all Q&A pairs loaded, hot per-example fields are
+  // kept in dense arrays, text and morphology in m_qatext
+  CBitSet           m_actives;
+  CBitSet           m_removed;
+  vector< UINT >    m_resids;
+  vector< UINT >    m_seqlens;
+  vector< float >   m_scores;
+  vector< UBYTE >   m_exacts;
+  vector< QAText >  m_qatext;
   // set of all vali Q&A pairs loaded
   vector< QAPair >  m_valiqaset;
-  // list of response IDs
+  // list of response IDs (in order of first appearance), the position
+  // of a response ID in this list is its response slot
   vector< UINT >    m_residlist;
+  map< UINT, UINT > m_resid2slot;
+  // response slot of each Q&A pair, first Q&A pair, number
+  // of Q&A pairs and of active Q&A pairs of each slot
+  vector< UINT >    m_slots;
+  vector< UINT >    m_slotfirst;
+  vector< UINT >    m_slotsize;
+  vector< UINT >    m_slotactive;
+  // next Q&A pair of the same slot (NO_QAINDEX: none),
+  // last Q&A pair of each slot
+  vector< UINT >    m_slotnext;
+  vector< UINT >    m_slotlast;
+  // number of Q&A pairs not removed (response priors: slot size / count)
+  UINT              m_remaining;
 
   // morpheme confusion probability table (joint, conditional probs)
   map< UINT, map <UINT, float> >    m_cftab_jp;
@@ -155,6 +469,56 @@ class QADB
 
   // maximum heap size for optimization
   UINT                              m_heapsize;
+  // number of threads for index construction
+  int                               m_threads;
+
+  // scores of the last query via the non-reentrant interface
+  QAContext                         m_context;
+};
+
+// loads a database (returns NULL on failure)
+typedef QADB * (*QALoader)(void * arg);
+
+// double-buffered database for long-running processes: a new database
+// is loaded by a background thread while the current one keeps serving,
+// and is then swapped in. each query pins the database it started on
+// (acquire/release), a replaced database is deleted after its last query
+class QAHandle
+{
+ public:
+  QAHandle(QADB * db);
+  virtual ~QAHandle();
+
+  QADB * acquire(void);
+  void release(QADB * db);
+
+  // install db as the current database
+  void swap(QADB * db);
+  // run loader(arg) in the background and swap in its database,
+  // returns false if the previous reload has not finished yet
+  bool reload(QALoader loader, void * arg);
+  // wait for the background reload, true if it installed a database
+  bool wait(void);
+  // number of databases installed so far
+  UINT generation(void) const { return m_generation; }
+
+ private:
+  QAHandle(const QAHandle &);
+  QAHandle & operator=(const QAHandle &);
+  static void * reload_worker(void * arg);
+
+  // current and replaced databases in use, with their number of users
+  map< QADB *, UINT > m_users;
+  QADB *          m_current;
+  UINT            m_generation;
+  pthread_mutex_t m_mutex;
+  // background reload
+  pthread_t       m_thread;
+  bool            m_loading;  // thread started and not joined
+  bool            m_loaded;   // last reload installed a database
+  bool            m_done;     // thread finished
+  QALoader        m_loader;
+  void *          m_arg;
 };
 
 #endif /* _QADB_H_ */
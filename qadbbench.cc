@@ -0,0 +1,402 @@
+/* ---------------------------------------------- --*-c++-*--
+ *
+ *  Retrieval Benchmark on Synthetic Q&A Databases
+ *
+ *  Copyright (c) 2006-2007 Nara Institute of Science and Technology
+ *
+ *  All Rights Reserved.
+ *
+ * ---------------------------------------------------------- */
+
+#include <getopt.h>
+#include <sys/time.h>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "qadb.h"
+
+int debug = 0;
+
+// morphemes of the synthetic data are separated by this character
+#define SYNTH_SEPARATOR '_'
+// morphemes with a row in the synthetic confusion table (most frequent)
+#define SYNTH_CONFUSED 100
+
+// parameters of a synthetic database and query set
+typedef struct {
+  UINT   m_examples;
+  UINT   m_responses;   // 0: one response per 10 examples
+  UINT   m_vocabulary;
+  double m_skew;        // zipf exponent of morpheme frequencies
+  UINT   m_length;      // mean number of morphemes per sentence
+  UINT   m_queries;
+  UINT   m_hypotheses;  // maximum number of n-best hypotheses per query
+  UINT   m_seed;
+} SynthParams;
+
+// generator of Q&A database, response and query files, the queries
+// are noisy copies of example questions (recognition errors)
+
+class CSynthesizer
+{
+public:
+  CSynthesizer (const SynthParams & params) ;
+  virtual ~CSynthesizer () {}
+
+  // write <prefix>.qadb, <prefix>.resp, <prefix>.query and
+  // the morpheme confusion table <prefix>.conf
+  bool generate (const string & prefix) ;
+
+private:
+  UINT   random (void) ;
+  double uniform (void) ;
+  UINT   morpheme (void) ;
+  void   sentence (vector<UINT> & words) ;
+  void   perturb (const vector<UINT> & words, vector<UINT> & noisy) ;
+  void   confusions (ostream & out) ;
+  string text (const vector<UINT> & words) ;
+
+  SynthParams    m_params ;
+  vector<double> m_cumulative ;  // zipf distribution of morphemes
+  UINT           m_state ;
+};
+
+CSynthesizer :: CSynthesizer (const SynthParams & params)
+  : m_params(params), m_cumulative(params.m_vocabulary), m_state(params.m_seed | 1)
+{
+  double sum = 0.0;
+  UINT i;
+
+  for (i=0; i<m_params.m_vocabulary; i++) {
+    sum += 1.0 / pow(static_cast<double>(i + 1), m_params.m_skew);
+    m_cumulative[i] = sum;
+  }
+  for (i=0; i<m_params.m_vocabulary; i++) m_cumulative[i] /= sum;
+}
+
+// xorshift generator: same data on every platform
+
+UINT CSynthesizer :: random (void)
+{
+  m_state ^= m_state << 13;
+  m_state ^= m_state >> 17;
+  m_state ^= m_state << 5;
+  return m_state;
+}
+
+double CSynthesizer :: uniform (void)
+{
+  return random() / 4294967296.0;
+}
+
+UINT CSynthesizer :: morpheme (void)
+{
+  vector<double>::iterator it;
+
+  it = lower_bound(m_cumulative.begin(), m_cumulative.end(), uniform());
+  if (it == m_cumulative.end()) it--;
+  return it - m_cumulative.begin();
+}
+
+void CSynthesizer :: sentence (vector<UINT> & words)
+{
+  UINT i, n = 1 + random() % (2 * m_params.m_length - 1);
+
+  words.resize(n);
+  for (i=0; i<n; i++) words[i] = morpheme();
+}
+
+// substitutions, deletions and insertions of morphemes,
+// some insertions are out of vocabulary (a few repeating ones)
+
+void CSynthesizer :: perturb (const vector<UINT> & words, vector<UINT> & noisy)
+{
+  double p;
+  UINT i;
+
+  noisy.clear();
+  for (i=0; i<words.size(); i++) {
+    p = uniform();
+    if (p < 0.10) continue;
+    noisy.push_back(p < 0.25 ? morpheme() : words[i]);
+    if (p > 0.98) noisy.push_back(m_params.m_vocabulary + random() % 8);
+    else if (p > 0.95) noisy.push_back(morpheme());
+  }
+  if (noisy.empty()) noisy.push_back(morpheme());
+}
+
+// joint probabilities P(ref,hyp) of the most frequent morphemes
+// (correct, substituted by a neighbour, deleted) and of insertions,
+// in the format of QADB::load_morphconftable
+
+void CSynthesizer :: confusions (ostream & out)
+{
+  double p;
+  UINT i, n;
+
+  n = (m_params.m_vocabulary < SYNTH_CONFUSED) ? m_params.m_vocabulary : SYNTH_CONFUSED;
+  for (i=0; i<n; i++) {
+    p = m_cumulative[i] - ((i > 0) ? m_cumulative[i-1] : 0.0);
+    out << "m" << i << " m" << i << " " << 0.80 * p;
+    out << " m" << (i + 1) % n << " " << 0.10 * p;
+    out << " m" << (i + 7) % n << " " << 0.05 * p;
+    out << " *DEL* " << 0.05 * p << "\n";
+  }
+  out << "*INS*";
+  for (i=0; i<n; i+=10) {
+    p = m_cumulative[i] - ((i > 0) ? m_cumulative[i-1] : 0.0);
+    out << " m" << i << " " << 0.01 * p;
+  }
+  out << "\n";
+}
+
+string CSynthesizer :: text (const vector<UINT> & words)
+{
+  ostringstream line;
+  UINT i;
+
+  for (i=0; i<words.size(); i++) {
+    if (i > 0) line << SYNTH_SEPARATOR;
+    line << "m" << words[i];
+  }
+  return line.str();
+}
+
+bool CSynthesizer :: generate (const string & prefix)
+{
+  ofstream qadb((prefix + ".qadb").c_str());
+  ofstream resp((prefix + ".resp").c_str());
+  ofstream query((prefix + ".query").c_str());
+  ofstream conf((prefix + ".conf").c_str());
+  vector< vector<UINT> > examples(m_params.m_examples);
+  vector<UINT> noisy;
+  UINT responses = m_params.m_responses;
+  UINT i, h, n;
+
+  if (responses == 0) responses = m_params.m_examples / 10 + 1;
+  for (i=1; i<=responses; i++) resp << i << " response" << i << "\n";
+  for (i=0; i<m_params.m_examples; i++) {
+    sentence(examples[i]);
+    qadb << (1 + random() % responses) << " " << text(examples[i]) << "\n";
+  }
+  for (i=0; i<m_params.m_queries; i++) {
+    const vector<UINT> & source = examples[random() % examples.size()];
+    n = 1 + random() % m_params.m_hypotheses;
+    for (h=0; h<n; h++) {
+      perturb(source, noisy);
+      query << (h > 0 ? "|" : "") << text(noisy);
+    }
+    query << "\n";
+  }
+  confusions(conf);
+
+  qadb.close();
+  resp.close();
+  query.close();
+  conf.close();
+  return not (qadb.fail() or resp.fail() or query.fail() or conf.fail());
+}
+
+// benchmark results: one line per measurement
+// <examples> <mode> <operation> <count> <seconds> <usec/op> <ops/s>
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report (UINT size, const char * mode, const char * operation,
+		    UINT count, double seconds)
+{
+  cout << size << "\t" << mode << "\t" << operation << "\t" << count << "\t" << seconds;
+  cout << "\t" << (count > 0 ? 1e6 * seconds / count : 0.0);
+  cout << "\t" << (seconds > 0 ? count / seconds : 0.0) << endl;
+}
+
+typedef struct {
+  const char * m_name;
+  MatchMode    m_mode;
+} ModeName;
+
+static const ModeName modes[] = {
+  { "exlen",  MATCH_EXLEN },
+  { "inlen",  MATCH_INLEN },
+  { "maxlen", MATCH_MAXLEN },
+  { "bayes",  MATCH_BAYES },
+  { "kbest",  MATCH_KBEST },
+  { "tfidf",  MATCH_TFIDF },
+};
+#define MODE_COUNT (sizeof(modes) / sizeof(modes[0]))
+
+// load text database of mode, time make_index and compile image
+
+static bool build_image (UINT size, const string & prefix, const ModeName & mode,
+			 const string & image)
+{
+  QADB * db;
+  double start;
+  bool ok;
+
+  start = now();
+  db = new QADB(prefix + ".qadb", prefix + ".resp", 100, mode.m_mode, SO_COSINUS);
+  report(size, mode.m_name, "load_text", db->qadb_size(), now() - start);
+  start = now();
+  db->make_index();
+  report(size, mode.m_name, "make_index", db->qadb_size(), now() - start);
+  ok = db->compile(image);
+  delete db;
+
+  return ok;
+}
+
+static void run_queries (UINT size, const ModeName & mode, const string & image,
+			 const vector<string> & queries, int nbest)
+{
+  QADB * db;
+  QAContext context;
+  vector<QAResult> results;
+  ofstream null("/dev/null");
+  streambuf * saved;
+  double start;
+  UINT i;
+
+  start = now();
+  db = new QADB(image, 100, mode.m_mode, SO_COSINUS);
+  report(size, mode.m_name, "load_image", db->qadb_size(), now() - start);
+
+  start = now();
+  for (i=0; i<queries.size(); i++) db->retrieve(queries[i].c_str(), context);
+  report(size, mode.m_name, "retrieve", queries.size(), now() - start);
+
+  start = now();
+  for (i=0; i<queries.size(); i++)
+    db->retrieve_nbest(queries[i].c_str(), nbest, true, context, results);
+  report(size, mode.m_name, "retrieve_nbest", queries.size(), now() - start);
+
+  // n-best output of the optimization code, written to nowhere
+  saved = cout.rdbuf(null.rdbuf());
+  start = now();
+  for (i=0; i<queries.size(); i++) db->print_nbestresid(queries[i].c_str(), nbest);
+  cout.rdbuf(saved);
+  report(size, mode.m_name, "print_nbestresid", queries.size(), now() - start);
+
+  delete db;
+}
+
+// generate database of params.m_examples and run all benchmarks on it
+
+static bool bench_size (const SynthParams & params, const string & base,
+			int nbest, bool generate_only)
+{
+  CSynthesizer synth(params);
+  vector<string> queries;
+  char input[MAX_BUFLEN+1];
+  string validated = base + ".img";
+  string tfidf = base + ".tfidf.img";
+  ifstream infile;
+  UINT m;
+
+  if (not synth.generate(base)) {
+    cerr << "Error: cannot write " << base << ".*" << endl;
+    return false;
+  }
+  if (generate_only) return true;
+
+  infile.open((base + ".query").c_str());
+  while (infile.getline(&input[0], MAX_BUFLEN))
+    if (strlen(&input[0]) > 0) queries.push_back(string(&input[0]));
+
+  // one image per kind of morpheme analysis (validated or not)
+  if (not build_image(params.m_examples, base, modes[2], validated) or
+      not build_image(params.m_examples, base, modes[MODE_COUNT-1], tfidf))
+    return false;
+
+  for (m=0; m<MODE_COUNT; m++)
+    run_queries(params.m_examples, modes[m],
+		(modes[m].m_mode == MATCH_TFIDF) ? tfidf : validated, queries, nbest);
+
+  return true;
+}
+
+static void help (const char * command)
+{
+  cerr << endl;
+  cerr << "Retrieval Benchmark on Synthetic Q&A Databases" << endl;
+  cerr << endl;
+  cerr << "Usage: " << command << " [options] > results.tsv" << endl << endl;
+  cerr << "  -n <int,...>     database sizes [1000,10000,100000,1000000]" << endl;
+  cerr << "  -r <int:resp>    number of responses [size/10]" << endl;
+  cerr << "  -v <int:vocab>   number of distinct morphemes [20000]" << endl;
+  cerr << "  -z <real:skew>   zipf exponent of morpheme frequencies [1.0]" << endl;
+  cerr << "  -l <int:length>  mean morphemes per sentence [8]" << endl;
+  cerr << "  -q <int:queries> number of queries [1000]" << endl;
+  cerr << "  -h <int:hyps>    maximum n-best hypotheses per query [3]" << endl;
+  cerr << "  -k <int:nbest>   n-best output for retrieve_nbest [10]" << endl;
+  cerr << "  -s <int:seed>    random seed [1]" << endl;
+  cerr << "  -o <prefix>      prefix of generated files [qadbbench]" << endl;
+  cerr << "  -g <bool>        only generate files" << endl;
+  cerr << endl;
+  cerr << "Output: <size> <mode> <operation> <count> <sec> <usec/op> <ops/sec>" << endl;
+  cerr << endl;
+}
+
+int main (int argc, char ** argv)
+{
+  SynthParams params;
+  vector<string> sizes;
+  string prefix = "qadbbench";
+  string sizelist = "1000,10000,100000,1000000";
+  bool generate_only = false;
+  int nbest = 10;
+  int opt;
+  UINT i;
+
+  params.m_responses  = 0;
+  params.m_vocabulary = 20000;
+  params.m_skew       = 1.0;
+  params.m_length     = 8;
+  params.m_queries    = 1000;
+  params.m_hypotheses = 3;
+  params.m_seed       = 1;
+
+  while ((opt = getopt(argc, argv, "n:r:v:z:l:q:h:k:s:o:g")) != -1) {
+    switch(opt) {
+    case 'n': sizelist = optarg; break;
+    case 'r': params.m_responses = atoi(optarg); break;
+    case 'v': params.m_vocabulary = atoi(optarg); break;
+    case 'z': params.m_skew = atof(optarg); break;
+    case 'l': params.m_length = atoi(optarg); break;
+    case 'q': params.m_queries = atoi(optarg); break;
+    case 'h': params.m_hypotheses = atoi(optarg); break;
+    case 'k': nbest = atoi(optarg); break;
+    case 's': params.m_seed = atoi(optarg); break;
+    case 'o': prefix = optarg; break;
+    case 'g': generate_only = true; break;
+    default:
+      help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (params.m_vocabulary < 1) params.m_vocabulary = 1;
+  if (params.m_length < 1) params.m_length = 1;
+  if (params.m_hypotheses < 1) params.m_hypotheses = 1;
+  if (nbest < 1) nbest = 1;
+
+  // the synthetic files are pre-tokenized, chasen is not needed
+  parse_pretokenized(SYNTH_SEPARATOR);
+
+  cout << "# examples\tmode\toperation\tcount\tseconds\tusec_per_op\tops_per_sec" << endl;
+  sizes = split(sizelist.c_str(), ',');
+  for (i=0; i<sizes.size(); i++) {
+    params.m_examples = atoi(sizes[i].c_str());
+    if (params.m_examples == 0) continue;
+    if (not bench_size(params, prefix + "." + sizes[i], nbest, generate_only))
+      return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,982 @@
+/* ---------------------------------------------- --*-c++-*--
+ *
+ *  Differential Retrieval Test and Performance Baseline
+ *
+ *  Copyright (c) 2006-2007 Nara Institute of Science and Technology
+ *
+ *  All Rights Reserved.
+ *
+ * ---------------------------------------------------------- */
+
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "qadb.h"
+#include "irt.cc"
+
+int debug = 0;
+
+// how the two engines are set up, the reference engine scores the
+// plain text or image database with QAReference (below), the candidate
+// is the retrieval of QADB with the options below.
+// an updated candidate is loaded without its last examples, which
+// are then added one by one (add_example), followed by as many decoy
+// examples which are removed again (remove_example). a masked run
+// restricts both engines to every step-th Q&A pair (query mask).
+// the conf mode needs a morpheme confusion table, which both engines
+// load themselves
+
+typedef struct {
+  const char * m_qadbfile;
+  const char * m_respfile;
+  const char * m_image;      // candidate database image (NULL: as reference)
+  bool         m_compress;   // candidate with compressed postings
+  int          m_cachesize;  // candidate result cache (queries are run twice)
+  int          m_nbest;      // compare n-best lists too if > 0
+  UINT         m_update;     // number of examples added to the candidate
+  UINT         m_maskstep;   // every m_maskstep-th Q&A pair allowed (0: no mask)
+  const char * m_conftable;  // morpheme confusion table (conf mode)
+} DiffOptions;
+
+// answer of an engine to one query, the score is kept as bit pattern
+// so that the comparison is exact
+
+typedef struct {
+  UINT   m_resid;
+  UINT   m_index;
+  UINT   m_score;
+  int    m_exact;
+  string m_nbest;
+} DiffAnswer;
+
+// one engine run on all queries of one match mode
+typedef struct {
+  double m_load;     // seconds
+  double m_query;    // seconds
+  long   m_maxrss;   // peak resident set size (kB)
+  UINT   m_hash;     // hash of all answers
+  vector<DiffAnswer> m_answers;
+} DiffRun;
+
+typedef struct {
+  const char * m_name;
+  MatchMode    m_mode;
+} ModeName;
+
+static const ModeName modes[] = {
+  { "exlen",  MATCH_EXLEN },
+  { "inlen",  MATCH_INLEN },
+  { "maxlen", MATCH_MAXLEN },
+  { "bayes",  MATCH_BAYES },
+  { "kbest",  MATCH_KBEST },
+  { "tfidf",  MATCH_TFIDF },
+  { "conf",   MATCH_CONF },
+};
+#define MODE_COUNT (sizeof(modes) / sizeof(modes[0]))
+
+// frozen copy of the retrieval before the fast path: match counts from
+// a plain map of postings, then a linear scan over all Q&A pairs. only
+// the analyzed examples are taken from the database, the postings,
+// priors, tf-idf matrix and ranking are kept here, so that changes of
+// the fast path cannot show up on both sides. changes to the original
+// loop: KBEST counts the best examples per response (not in an array
+// indexed by response ID), ties go to the lower index. the confusion
+// table is read by a copy of QADB::load_morphconftable
+
+class QAReference
+{
+public:
+  QAReference (const QADB & db, MatchMode mode) ;
+  virtual ~QAReference () {}
+
+  // use only the active Q&A pairs whose bit is set in mask (NULL: all)
+  void set_mask (const CBitSet * mask) { m_mask = mask; }
+  // morpheme confusion table for MATCH_CONF
+  bool load_confusions (const char * file) ;
+
+  QAResult retrieve (const string & input) ;
+  // best example per response (KBEST, TFIDF: responses), best first
+  UINT retrieve_nbest (const string & input, UINT nbest, vector<QAResult> & results) ;
+
+private:
+  void  parse (const string & input) ;
+  UINT  morph2code (const string & morph) ;
+  void  score (void) ;
+  float confusion (UINT index, float maxlen) ;
+  float conf_prob (UINT ref, UINT hyp) const ;
+  void  tfidf_scores (vector<float> & scores) ;
+  float kbest (UINT slot, UINT * best) ;
+  bool  exact (UINT index) const ;
+  bool  allowed (UINT index) const ;
+  bool  usable (UINT slot) const ;
+
+  MatchMode                 m_mode ;
+  const CBitSet *           m_mask ;
+  map< string, UINT >       m_lexicon ;
+  UINT                      m_maxcode ;
+  map< UINT, vector<UINT> > m_postings ;
+  vector<bool>              m_actives ;
+  vector<UINT>              m_resids ;
+  vector<UINT>              m_seqlens ;
+  vector< vector<UINT> >    m_codeseqs ;
+  vector<UINT>              m_slots ;
+  vector<UINT>              m_residlist ;  // responses in order of appearance
+  vector< vector<UINT> >    m_slotlist ;   // Q&A pairs of each response
+  vector<float>             m_priors ;
+  CTermDocuMatrix<UINT>     m_matrix ;
+  map< UINT, map<UINT,float> > m_confprob ;  // P(hyp|ref), [0][0]: smallest
+  // current query and its match counts and scores
+  vector<UINT>              m_codes ;
+  int                       m_hypcnt ;
+  vector<UINT>              m_counts ;
+  vector<float>             m_scores ;
+};
+
+// ranking of (score, index) pairs: higher score first, then lower index
+static bool better (const pair<float,UINT> & a, const pair<float,UINT> & b)
+{
+  return a.first > b.first or (a.first == b.first and a.second < b.second);
+}
+
+QAReference :: QAReference (const QADB & db, MatchMode mode)
+  : m_mode(mode), m_mask(NULL), m_maxcode(db.morph_cnt()), m_matrix(SO_COSINUS), m_hypcnt(0)
+{
+  map<UINT,UINT> slots;
+  map< UINT, CTermVector<UINT> > tfvectors;
+  map<UINT,UINT>::iterator it;
+  UINT i, k, n;
+
+  n = db.qadb_size();
+  for (i=0; i<n; i++) {
+    const QAText & text = db.qatext(i);
+    QAPair pair = db.qapair(i);
+    it = slots.find(pair.m_resid);
+    if (it == slots.end()) {
+      it = slots.insert(make_pair(pair.m_resid, static_cast<UINT>(m_residlist.size()))).first;
+      m_residlist.push_back(pair.m_resid);
+      m_slotlist.push_back(vector<UINT>());
+      m_priors.push_back(0.0);
+    }
+    m_actives.push_back(pair.m_active);
+    m_resids.push_back(pair.m_resid);
+    m_seqlens.push_back(pair.m_seqlen);
+    m_codeseqs.push_back(text.m_codeseq);
+    m_slots.push_back(it->second);
+    m_slotlist[it->second].push_back(i);
+    m_priors[it->second] += 1.0;
+    for (k=0; k<text.m_codeseq.size(); k++)
+      m_lexicon[text.m_morphseq[k].m_origin] = text.m_codeseq[k];
+    if (not pair.m_active) continue;
+    for (k=0; k<text.m_codeseq.size(); k++) m_postings[text.m_codeseq[k]].push_back(i);
+    tfvectors[pair.m_resid].add_termlist(pair.m_codeseq);
+  }
+  for (k=0; k<m_priors.size(); k++) m_priors[k] /= static_cast<float>(n);
+
+  if (m_mode == MATCH_TFIDF) {
+    for (k=0; k<m_residlist.size(); k++)
+      m_matrix.add_document(tfvectors[m_residlist[k]], m_residlist[k]);
+    m_matrix.to_tfidf();
+  }
+}
+
+// query codes, a hypothesis of weight w is repeated w times,
+// MATCH_CONF uses the first hypothesis once (total weight as hypcnt)
+
+void QAReference :: parse (const string & input)
+{
+  vector<string> hypvec = split(input.c_str(), '|');
+  map<string,UINT> morphcnt;
+  Sentence morphseq;
+  string hyp;
+  string::size_type tab;
+  const char * text;
+  char * rest;
+  char suffix[12];
+  long weight;
+  UINT i, k, w, n;
+
+  m_codes.clear();
+  m_hypcnt = 0;
+  for (i=0; i<hypvec.size(); i++) {
+    hyp = hypvec[i];
+    weight = 1;
+    tab = hyp.rfind('\t');
+    if (tab != string::npos) {
+      text   = hyp.c_str() + tab + 1;
+      weight = strtol(text, &rest, 10);
+      if (rest == text or *rest != '\0' or weight < 0 or weight > MAX_HYPWEIGHT) {
+	m_codes.clear();
+	m_hypcnt = 0;
+	return;
+      }
+      hyp.erase(tab);
+    }
+    m_hypcnt += weight;
+    if (weight == 0 or (m_mode == MATCH_CONF and i > 0)) continue;
+    morphseq = parse_sentence(hyp.c_str());
+    // same morpheme twice in a hypothesis: "<morph>:2", ...
+    if (m_mode != MATCH_TFIDF and m_mode != MATCH_CONF) {
+      morphcnt.clear();
+      for (k=0; k<morphseq.size(); k++) {
+	morphcnt[morphseq[k].m_origin] += 1;
+	if (morphcnt[morphseq[k].m_origin] >= 2) {
+	  sprintf(&suffix[0], ":%u", morphcnt[morphseq[k].m_origin]);
+	  morphseq[k].m_origin += string(&suffix[0]);
+	}
+      }
+    }
+    n = (m_mode == MATCH_CONF) ? 1 : static_cast<UINT>(weight);
+    for (w=0; w<n; w++) {
+      for (k=0; k<morphseq.size(); k++) m_codes.push_back(morph2code(morphseq[k].m_origin));
+    }
+  }
+}
+
+// unknown morphemes are registered with a new code (original morph2code)
+
+UINT QAReference :: morph2code (const string & morph)
+{
+  if (m_lexicon[morph] == 0) {
+    m_maxcode++;
+    m_lexicon[morph] = m_maxcode;
+  }
+  return m_lexicon[morph];
+}
+
+// match counts and scores of all Q&A pairs
+
+void QAReference :: score (void)
+{
+  map< UINT, vector<UINT> >::const_iterator it;
+  float inlen, exlen, maxlen, score;
+  UINT i, j, k, n;
+
+  n = m_resids.size();
+  m_counts.assign(n, 0);
+  m_scores.assign(n, 0.0);
+  for (j=0; j<m_codes.size(); j++) {
+    it = m_postings.find(m_codes[j]);
+    if (it == m_postings.end()) continue;
+    for (k=0; k<it->second.size(); k++)
+      if (allowed(it->second[k])) m_counts[it->second[k]]++;
+  }
+
+  inlen = static_cast<float>(m_codes.size());
+  for (i=0; i<n; i++) {
+    exlen = static_cast<float>(m_seqlens[i] * m_hypcnt);
+    maxlen = (inlen > exlen) ? inlen : exlen;
+    switch(m_mode) {
+    case MATCH_MAXLEN:
+    case MATCH_KBEST:
+      // prefer higher match counts / longer examples (heuristic)
+      m_scores[i] = pow(static_cast<double>(m_counts[i]),1.0001) / maxlen;
+      break;
+    case MATCH_EXLEN:
+      m_scores[i] = static_cast<float>(m_counts[i]) / exlen;
+      break;
+    case MATCH_INLEN:
+      m_scores[i] = static_cast<float>(m_counts[i]) / inlen;
+      break;
+    case MATCH_BAYES:
+      score = pow(static_cast<double>(m_counts[i]),1.0001) / maxlen;
+      m_scores[i] = score * m_priors[m_slots[i]];
+      break;
+    case MATCH_CONF:
+      if (allowed(i)) m_scores[i] = confusion(i, maxlen);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// geometric mean of the confusion probabilities along the alignment
+// of example and query, the match count if all steps are certain
+
+float QAReference :: confusion (UINT index, float maxlen)
+{
+  vector<AlignElement> alignpath;
+  float score = 0.0;
+  UINT j, len, r = 0, s = 0;
+
+  alignpath = alignment(m_codeseqs[index], m_codes);
+  len = alignpath.size();
+  for (j=0; j<len; j++) {
+    if (alignpath[j].m_type == ALIGN_COR || alignpath[j].m_type == ALIGN_SUB) {
+      r = m_codeseqs[index][alignpath[j].m_ref];
+      s = m_codes[alignpath[j].m_hyp];
+    } else if (alignpath[j].m_type == ALIGN_INS) {
+      r = 0;
+      s = m_codes[alignpath[j].m_hyp];
+    } else if (alignpath[j].m_type == ALIGN_DEL) {
+      r = m_codeseqs[index][alignpath[j].m_ref];
+      s = 0;
+    }
+    if (conf_prob(r,s) != 0.0) {
+      score += log(conf_prob(r,s));
+    } else {
+      score += log(conf_prob(0,0));
+    }
+  }
+  if (score != 0.0) return exp(score / static_cast<float>(len));
+  return m_counts[index] / static_cast<float>(maxlen);
+}
+
+float QAReference :: conf_prob (UINT ref, UINT hyp) const
+{
+  map< UINT, map<UINT,float> >::const_iterator it = m_confprob.find(ref);
+  map<UINT,float>::const_iterator jt;
+
+  if (it == m_confprob.end()) return 0.0;
+  jt = it->second.find(hyp);
+  return (jt != it->second.end()) ? jt->second : 0.0;
+}
+
+// lines "<ref> <hyp> <P(ref,hyp)> <hyp> ...", conditional probabilities
+// P(hyp|ref) of hypotheses which have a row themselves, *INS* and *DEL*
+// get new codes (code 0 of the scoring is the smallest probability)
+
+bool QAReference :: load_confusions (const char * file)
+{
+  ifstream infile(file);
+  char buffer[MAX_BUFLEN+1];
+  char separator[3] = {' ','\t','\0'};
+  char * strp;
+  map< UINT, map<UINT,float> > joint;
+  map< UINT, map<UINT,float> >::const_iterator it;
+  map<UINT,float>::const_iterator jt;
+  map<UINT,float> marginal;
+  UINT refc, hypc;
+  float prob;
+
+  if (not infile) {
+    cerr << "Error: cannot read " << file << endl;
+    return false;
+  }
+  m_lexicon[string("*INS*")] = 0;
+  m_lexicon[string("*DEL*")] = 0;
+  while (infile.getline(&buffer[0], MAX_BUFLEN)) {
+    strp = strtok(&buffer[0], &separator[0]);
+    if (strp == NULL) continue;
+    refc = morph2code(string(strp));
+    while ((strp = strtok(NULL, &separator[0])) != NULL) {
+      hypc = morph2code(string(strp));
+      if ((strp = strtok(NULL, &separator[0])) == NULL) break;
+      prob = atof(strp);
+      joint[refc][hypc] = prob;
+      marginal[refc] += prob;
+    }
+  }
+
+  prob = 1.0;
+  for (it=joint.begin(); it!=joint.end(); it++) {
+    for (jt=it->second.begin(); jt!=it->second.end(); jt++) {
+      if (jt->second != 0.0 and marginal[jt->first] != 0.0) {
+	m_confprob[it->first][jt->first] = jt->second / marginal[it->first];
+	prob = (m_confprob[it->first][jt->first] < prob) ? m_confprob[it->first][jt->first] : prob;
+      }
+    }
+  }
+  m_confprob[0][0] = prob;
+
+  return true;
+}
+
+// similarity of the query with each response (tf-idf matrix)
+
+void QAReference :: tfidf_scores (vector<float> & scores)
+{
+  CTermVector<UINT> query(SO_COSINUS);
+  CTermVector<UINT> exvec;
+  UINT j;
+
+  query.add_termlist(m_codes);
+  query.norm();
+  scores.clear();
+  for (j=0; j<m_residlist.size(); j++) {
+    exvec = m_matrix[m_residlist[j]];
+    scores.push_back(exvec * query);
+  }
+}
+
+// average of the KBEST_SIZE best example scores of a response,
+// summed up best first
+
+float QAReference :: kbest (UINT slot, UINT * best)
+{
+  vector< pair<float,UINT> > scores;
+  float sum = 0.0;
+  UINT k, m;
+
+  for (k=0; k<m_slotlist[slot].size(); k++)
+    scores.push_back(make_pair(m_scores[m_slotlist[slot][k]], m_slotlist[slot][k]));
+  sort(scores.begin(), scores.end(), better);
+  m = (scores.size() < KBEST_SIZE) ? scores.size() : KBEST_SIZE;
+  for (k=0; k<m; k++) sum += scores[k].first;
+  if (best != NULL) *best = scores[0].second;
+
+  return sum / static_cast<float>(m);
+}
+
+bool QAReference :: exact (UINT index) const
+{
+  float inlen = static_cast<float>(m_codes.size());
+  float exlen = static_cast<float>(m_seqlens[index] * m_hypcnt);
+
+  return (inlen == exlen && inlen == m_counts[index]);
+}
+
+bool QAReference :: allowed (UINT index) const
+{
+  return m_actives[index] and (m_mask == NULL or m_mask->test(index));
+}
+
+// response with at least one allowed Q&A pair
+
+bool QAReference :: usable (UINT slot) const
+{
+  UINT k;
+
+  for (k=0; k<m_slotlist[slot].size(); k++)
+    if (allowed(m_slotlist[slot][k])) return true;
+  return false;
+}
+
+QAResult QAReference :: retrieve (const string & input)
+{
+  QAResult result;
+  vector<float> scores;
+  float slotscore, maxscore = 0.0;
+  UINT i, j, best = 0;
+  bool found = false;
+
+  parse(input);
+  result.m_index = NO_QAINDEX;
+  result.m_exact = false;
+  if (m_mode == MATCH_TFIDF and m_mask == NULL) {
+    result.m_resid = m_matrix.retrieve(m_codes, &result.m_score);
+    return result;
+  }
+  if (m_mode == MATCH_TFIDF) {
+    // best usable response, the first usable one if none scores
+    tfidf_scores(scores);
+    result.m_resid = m_residlist.empty() ? 0 : m_residlist[0];
+    result.m_score = 0.0;
+    for (j=0; j<m_residlist.size(); j++) {
+      if (not usable(j)) continue;
+      if (not found or scores[j] > result.m_score) {
+	result.m_resid = m_residlist[j];
+	result.m_score = scores[j];
+	found = true;
+      }
+    }
+    return result;
+  }
+
+  score();
+  for (i=0; i<m_scores.size(); i++) {
+    if (m_scores[i] > maxscore) {
+      maxscore = m_scores[i];
+      best = i;
+    }
+  }
+  result.m_index = best;
+  if (m_mode == MATCH_KBEST) {
+    // as the original loop: the best example index
+    // stands for the response if no response scores
+    maxscore = 0.0;
+    for (j=0; j<m_residlist.size(); j++) {
+      slotscore = kbest(j, NULL);
+      if (slotscore > maxscore) {
+	maxscore = slotscore;
+	best = m_residlist[j];
+      }
+    }
+    result.m_resid = best;
+    result.m_score = maxscore;
+  } else {
+    result.m_resid = m_resids[best];
+    result.m_score = m_scores[best];
+    result.m_exact = (m_mode != MATCH_CONF) and exact(best);
+  }
+  return result;
+}
+
+UINT QAReference :: retrieve_nbest (const string & input, UINT nbest,
+				    vector<QAResult> & results)
+{
+  vector< pair<float,UINT> > ranking;
+  vector<UINT> slotbest;
+  vector<float> scores;
+  QAResult result;
+  UINT i, j, k;
+
+  parse(input);
+  results.clear();
+  slotbest.assign(m_residlist.size(), NO_QAINDEX);
+  // responses without usable Q&A pair are not listed
+  if (m_mode == MATCH_TFIDF) {
+    tfidf_scores(scores);
+    for (j=0; j<m_residlist.size(); j++)
+      if (usable(j)) ranking.push_back(make_pair(scores[j], j));
+  } else if (m_mode == MATCH_KBEST) {
+    score();
+    for (j=0; j<m_residlist.size(); j++)
+      if (usable(j)) ranking.push_back(make_pair(kbest(j, &slotbest[j]), j));
+  } else {
+    // Q&A pairs without matching morpheme are not listed,
+    // MATCH_CONF lists all usable Q&A pairs
+    score();
+    for (i=0; i<m_scores.size(); i++) {
+      j = m_slots[i];
+      if ((m_mode == MATCH_CONF) ? not allowed(i) : m_counts[i] == 0) continue;
+      if (slotbest[j] == NO_QAINDEX or m_scores[i] > m_scores[slotbest[j]]) slotbest[j] = i;
+    }
+    for (j=0; j<m_residlist.size(); j++)
+      if (slotbest[j] != NO_QAINDEX) ranking.push_back(make_pair(m_scores[slotbest[j]], slotbest[j]));
+  }
+  sort(ranking.begin(), ranking.end(), better);
+
+  for (k=0; k<ranking.size() and k<nbest; k++) {
+    result.m_score = ranking[k].first;
+    result.m_exact = false;
+    if (m_mode == MATCH_TFIDF or m_mode == MATCH_KBEST) {
+      result.m_resid = m_residlist[ranking[k].second];
+      result.m_index = slotbest[ranking[k].second];
+    } else {
+      result.m_index = ranking[k].second;
+      result.m_resid = m_resids[result.m_index];
+      result.m_exact = (m_mode != MATCH_CONF) and exact(result.m_index);
+    }
+    results.push_back(result);
+  }
+  return results.size();
+}
+
+static double now (void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static UINT score_bits (float score)
+{
+  UINT bits;
+
+  memcpy(&bits, &score, sizeof(bits));
+  return bits;
+}
+
+static float bits_score (UINT bits)
+{
+  float score;
+
+  memcpy(&score, &bits, sizeof(score));
+  return score;
+}
+
+// candidate database built by updates, the decoys are the first
+// hypotheses of the queries, so that each one would answer its
+// query exactly if it were not removed
+
+static QADB * load_updated (const DiffOptions & opts, const ModeName & mode,
+			    const vector<string> & queries)
+{
+  ifstream infile(opts.m_qadbfile);
+  char buffer[MAX_BUFLEN+1];
+  char tmpfile[] = "/tmp/qadbdiff.XXXXXX";
+  vector<string> examples;
+  vector<string> tokens;
+  vector<UINT> decoys;
+  string hyp;
+  QADB * db;
+  UINT i, k, keep, resid;
+  int fd;
+
+  // example lines as read by load_examples
+  while (infile.getline(&buffer[0], MAX_BUFLEN)) {
+    if (buffer[0] == '#' or buffer[0] == ' ' or strlen(&buffer[0]) < 4) continue;
+    if (split(&buffer[0], ' ').size() == 2) examples.push_back(string(&buffer[0]));
+  }
+  if (examples.size() <= opts.m_update) {
+    cerr << "Error: database has only " << examples.size() << " examples." << endl;
+    return NULL;
+  }
+  keep = examples.size() - opts.m_update;
+  if ((fd = mkstemp(tmpfile)) < 0) return NULL;
+  close(fd);
+  ofstream outfile(tmpfile);
+  for (i=0; i<keep; i++) outfile << examples[i] << endl;
+  outfile.close();
+  db = new QADB(string(tmpfile), string(opts.m_respfile), 100, mode.m_mode, SO_COSINUS);
+  unlink(tmpfile);
+
+  for (i=keep; i<examples.size(); i++) {
+    tokens = split(examples[i].c_str(), ' ');
+    db->add_example(atoi(tokens[0].c_str()), tokens[1].c_str());
+  }
+  resid = atoi(examples[0].c_str());
+  for (k=0; k<opts.m_update and k<queries.size(); k++) {
+    hyp = queries[k].substr(0, queries[k].find('|'));
+    hyp = hyp.substr(0, hyp.find('\t'));
+    decoys.push_back(db->add_example(resid, hyp.c_str()));
+  }
+  for (k=0; k<decoys.size(); k++) db->remove_example(decoys[k]);
+
+  return db;
+}
+
+// run one engine in a child process, so that every run has its own
+// peak memory, the answers come back through a pipe as lines:
+//   <load sec> <query sec> <maxrss kB> <count>
+//   <resid> <index> <score bits> <exact> [<resid>:<score bits>/...]
+
+static void engine_child (FILE * out, const DiffOptions & opts, const ModeName & mode,
+			  bool reference, const vector<string> & queries)
+{
+  QADB * db;
+  QAReference * scorer = NULL;
+  QAContext context;
+  CBitSet mask;
+  vector<QAResult> results;
+  vector<QAResult> answers(queries.size());
+  vector<string> nbests(queries.size());
+  struct rusage usage;
+  double start, load, query;
+  UINT i, k, pass, passes;
+  ostringstream list;
+
+  start = now();
+  if (not reference and opts.m_image != NULL)
+    db = new QADB(string(opts.m_image), 100, mode.m_mode, SO_COSINUS);
+  else if (not reference and opts.m_update > 0)
+    db = load_updated(opts, mode, queries);
+  else if (opts.m_respfile == NULL)
+    db = new QADB(string(opts.m_qadbfile), 100, mode.m_mode, SO_COSINUS);
+  else
+    db = new QADB(string(opts.m_qadbfile), string(opts.m_respfile), 100,
+		  mode.m_mode, SO_COSINUS);
+  if (db == NULL or not db->loaded()) return;
+  if (reference) {
+    scorer = new QAReference(*db, mode.m_mode);
+    if (mode.m_mode == MATCH_CONF and not scorer->load_confusions(opts.m_conftable)) return;
+  } else {
+    if (mode.m_mode == MATCH_CONF) db->load_morphconftable(string(opts.m_conftable));
+    if (opts.m_compress) db->set_compressed_index(true);
+    db->set_cache(opts.m_cachesize);
+  }
+  load = now() - start;
+
+  if (opts.m_maskstep > 0) {
+    mask.resize(db->qadb_size());
+    for (i=0; i<db->qadb_size(); i+=opts.m_maskstep) mask.set(i);
+    if (reference) scorer->set_mask(&mask);
+    else context.set_mask(&mask);
+  }
+
+  // a cached candidate answers the second pass from the cache
+  passes = (not reference and opts.m_cachesize > 0) ? 2 : 1;
+  start = now();
+  for (pass=0; pass<passes; pass++) {
+    for (i=0; i<queries.size(); i++) {
+      if (reference)
+	answers[i] = scorer->retrieve(queries[i]);
+      else
+	answers[i] = db->retrieve(queries[i].c_str(), context);
+      if (opts.m_nbest <= 0) continue;
+      if (reference)
+	scorer->retrieve_nbest(queries[i], opts.m_nbest, results);
+      else
+	db->retrieve_nbest(queries[i].c_str(), opts.m_nbest, true, context, results);
+      list.str("");
+      for (k=0; k<results.size(); k++)
+	list << (k > 0 ? "/" : "") << results[k].m_resid << ":" << score_bits(results[k].m_score);
+      nbests[i] = list.str();
+    }
+  }
+  query = now() - start;
+  getrusage(RUSAGE_SELF, &usage);
+
+  fprintf(out, "%f %f %ld %u\n", load, query, usage.ru_maxrss, (UINT)queries.size());
+  for (i=0; i<queries.size(); i++) {
+    fprintf(out, "%u %u %u %d", answers[i].m_resid, answers[i].m_index,
+	    score_bits(answers[i].m_score), answers[i].m_exact ? 1 : 0);
+    if (opts.m_nbest > 0) fprintf(out, " %s", nbests[i].c_str());
+    fprintf(out, "\n");
+  }
+  if (scorer != NULL) delete scorer;
+  delete db;
+}
+
+static bool run_engine (const DiffOptions & opts, const ModeName & mode, bool reference,
+			const vector<string> & queries, DiffRun & run)
+{
+  char line[MAX_BUFLEN+1];
+  DiffAnswer answer;
+  char list[MAX_BUFLEN+1];
+  int fds[2], status, fields;
+  UINT i, n = 0;
+  char * p;
+  FILE * in;
+  pid_t pid;
+
+  if (pipe(fds) != 0) return false;
+  if ((pid = fork()) < 0) return false;
+  if (pid == 0) {
+    close(fds[0]);
+    in = fdopen(fds[1], "w");
+    engine_child(in, opts, mode, reference, queries);
+    fclose(in);
+    _exit(EXIT_SUCCESS);
+  }
+  close(fds[1]);
+  in = fdopen(fds[0], "r");
+
+  run.m_answers.clear();
+  run.m_hash = 2166136261U;
+  if (fgets(line, sizeof(line), in) == NULL or
+      sscanf(line, "%lf %lf %ld %u", &run.m_load, &run.m_query, &run.m_maxrss, &n) != 4)
+    n = 0;
+  for (i=0; i<n and fgets(line, sizeof(line), in) != NULL; i++) {
+    list[0] = '\0';
+    fields = sscanf(line, "%u %u %u %d %s", &answer.m_resid, &answer.m_index,
+		    &answer.m_score, &answer.m_exact, list);
+    if (fields < 4) break;
+    answer.m_nbest = list;
+    run.m_answers.push_back(answer);
+    // FNV-1a over the answer lines
+    for (p=&line[0]; *p != '\0'; p++) run.m_hash = (run.m_hash ^ UBYTE(*p)) * 16777619U;
+  }
+  fclose(in);
+  waitpid(pid, &status, 0);
+
+  return (WIFEXITED(status) and WEXITSTATUS(status) == EXIT_SUCCESS and
+	  n == queries.size() and run.m_answers.size() == n);
+}
+
+// report every query on which the engines disagree, returns their number
+
+static UINT compare_runs (const ModeName & mode, const vector<string> & queries,
+			  const DiffRun & ref, const DiffRun & cand)
+{
+  UINT i, diffs = 0;
+  string what;
+
+  for (i=0; i<queries.size(); i++) {
+    const DiffAnswer & a = ref.m_answers[i];
+    const DiffAnswer & b = cand.m_answers[i];
+    what = "";
+    if (a.m_resid != b.m_resid) what += "resid,";
+    if (a.m_index != b.m_index) what += "index,";
+    if (a.m_score != b.m_score) what += "score,";
+    if (a.m_exact != b.m_exact) what += "exact,";
+    if (a.m_nbest != b.m_nbest) what += "nbest,";
+    if (what.empty()) continue;
+    what.erase(what.size() - 1);
+    diffs++;
+    cout << "DIFF\t" << mode.m_name << "\t" << (i + 1) << "\t" << what;
+    cout << "\t" << a.m_resid << "/" << bits_score(a.m_score) << "/" << a.m_exact;
+    cout << "\t" << b.m_resid << "/" << bits_score(b.m_score) << "/" << b.m_exact;
+    cout << "\t" << queries[i] << endl;
+  }
+  return diffs;
+}
+
+// stored baseline: <mode> <engine> <load sec> <query sec> <maxrss kB> <answer hash>
+
+typedef map< string, DiffRun > Baseline;
+
+static void load_baseline (const char * file, Baseline & baseline)
+{
+  ifstream infile(file);
+  string mode, engine;
+  DiffRun run;
+
+  while (infile >> mode >> engine >> run.m_load >> run.m_query >> run.m_maxrss >> run.m_hash)
+    baseline[mode + "/" + engine] = run;
+}
+
+static void save_run (ostream & out, const ModeName & mode, const char * engine,
+		      const DiffRun & run)
+{
+  out << mode.m_name << "\t" << engine << "\t" << run.m_load << "\t" << run.m_query;
+  out << "\t" << run.m_maxrss << "\t" << run.m_hash << endl;
+}
+
+// compare run with baseline, returns the number of regressions
+
+static UINT check_baseline (const Baseline & baseline, const ModeName & mode,
+			    const char * engine, const DiffRun & run, double tolerance)
+{
+  Baseline::const_iterator it = baseline.find(string(mode.m_name) + "/" + engine);
+  UINT regressions = 0;
+
+  if (it == baseline.end()) return 0;
+  if (it->second.m_hash != run.m_hash) {
+    cout << "CHANGED\t" << mode.m_name << "\t" << engine << "\tanswers differ from baseline" << endl;
+    regressions++;
+  }
+  if (run.m_query > it->second.m_query * (1.0 + tolerance)) {
+    cout << "SLOWER\t" << mode.m_name << "\t" << engine << "\t" << run.m_query;
+    cout << " s (baseline " << it->second.m_query << " s)" << endl;
+    regressions++;
+  }
+  if (run.m_maxrss > it->second.m_maxrss * (1.0 + tolerance)) {
+    cout << "LARGER\t" << mode.m_name << "\t" << engine << "\t" << run.m_maxrss;
+    cout << " kB (baseline " << it->second.m_maxrss << " kB)" << endl;
+    regressions++;
+  }
+  return regressions;
+}
+
+static void help (const char * command)
+{
+  cerr << endl;
+  cerr << "Differential Retrieval Test and Performance Baseline" << endl;
+  cerr << endl;
+  cerr << "Usage: " << command << " -i <qadb> -r <resp> -q <queries> [options]" << endl << endl;
+  cerr << "  -i <file:qadb>   question and answer database or image" << endl;
+  cerr << "  -r <file:resp>   file with response sentences" << endl;
+  cerr << "  -q <file:query>  recorded queries" << endl;
+  cerr << "  -m <mode,...>    exlen,inlen,maxlen,bayes,kbest,tfidf,conf [all but conf]" << endl;
+  cerr << "  -f <file:conf>   morpheme confusion table (conf mode)" << endl;
+  cerr << "  -n <int:nbest>   compare n-best lists too" << endl;
+  cerr << "  -I <file:image>  candidate loads compiled image" << endl;
+  cerr << "  -z <bool>        candidate with compressed postings lists" << endl;
+  cerr << "  -l <int:size>    candidate with result cache (queries run twice)" << endl;
+  cerr << "  -u <int:count>   candidate adds its last examples and removes decoys" << endl;
+  cerr << "  -a <int:step>    queries use every step-th Q&A pair only (mask)" << endl;
+  cerr << "  -b <file:base>   compare with baseline (written if missing)" << endl;
+  cerr << "  -w <bool>        write baseline even if it exists" << endl;
+  cerr << "  -x <int:percent> tolerated slowdown and growth [10]" << endl;
+  cerr << "  -c <config>      chasenrc configuration file" << endl;
+  cerr << "  -p <char:sep>    pre-tokenized input, no chasen analysis" << endl;
+  cerr << endl;
+  cerr << "Output: DIFF <mode> <query#> <fields> <ref resid/score/exact> <cand ...> <query>" << endl;
+  cerr << "        RUN <mode> <engine> <load sec> <query sec> <maxrss kB> <hash>" << endl;
+  cerr << "Exit status is 1 on disagreements or regressions." << endl;
+  cerr << endl;
+}
+
+int main (int argc, char ** argv)
+{
+  DiffOptions opts;
+  Baseline baseline;
+  DiffRun ref, cand;
+  vector<string> queries;
+  vector<string> names;
+  vector<UINT> selected;
+  ostringstream runs;
+  const char * queryfile = NULL;
+  const char * chacfgfile = NULL;
+  const char * basefile = NULL;
+  char separator = 0;
+  char input[MAX_BUFLEN+1];
+  bool rewrite = false;
+  double tolerance = 0.10;
+  UINT diffs = 0, regressions = 0;
+  UINT i, m;
+  int opt;
+
+  opts.m_qadbfile  = NULL;
+  opts.m_respfile  = NULL;
+  opts.m_image     = NULL;
+  opts.m_compress  = false;
+  opts.m_cachesize = 0;
+  opts.m_nbest     = 0;
+  opts.m_update    = 0;
+  opts.m_maskstep  = 0;
+  opts.m_conftable = NULL;
+  names = split("exlen,inlen,maxlen,bayes,kbest,tfidf", ',');
+
+  while ((opt = getopt(argc, argv, "i:r:q:m:n:I:l:u:a:f:b:x:c:p:zwh")) != -1) {
+    switch(opt) {
+    case 'i': opts.m_qadbfile = optarg; break;
+    case 'r': opts.m_respfile = optarg; break;
+    case 'q': queryfile = optarg; break;
+    case 'm': names = split(optarg, ','); break;
+    case 'n': opts.m_nbest = atoi(optarg); break;
+    case 'I': opts.m_image = optarg; break;
+    case 'z': opts.m_compress = true; break;
+    case 'l': opts.m_cachesize = atoi(optarg); break;
+    case 'u': opts.m_update = atoi(optarg); break;
+    case 'a': opts.m_maskstep = atoi(optarg); break;
+    case 'f': opts.m_conftable = optarg; break;
+    case 'b': basefile = optarg; break;
+    case 'w': rewrite = true; break;
+    case 'x': tolerance = atoi(optarg) / 100.0; break;
+    case 'c': chacfgfile = optarg; break;
+    case 'p': separator = optarg[0]; break;
+    default:
+      help(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (opts.m_qadbfile == NULL or queryfile == NULL or
+      (opts.m_respfile == NULL and not QADB::is_image(string(opts.m_qadbfile)))) {
+    help(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (opts.m_update > 0 and (opts.m_respfile == NULL or opts.m_image != NULL)) {
+    cerr << "Error: updates need a text database (-i, -r) and no image (-I)." << endl;
+    return EXIT_FAILURE;
+  }
+  for (i=0; i<names.size(); i++) {
+    for (m=0; m<MODE_COUNT; m++) if (names[i] == modes[m].m_name) break;
+    if (m == MODE_COUNT) {
+      cerr << "Error: unknown match mode " << names[i] << endl;
+      return EXIT_FAILURE;
+    }
+    if (modes[m].m_mode == MATCH_CONF and opts.m_conftable == NULL) {
+      cerr << "Error: match mode conf needs a confusion table (-f)." << endl;
+      return EXIT_FAILURE;
+    }
+    selected.push_back(m);
+  }
+
+  if (separator != 0) parse_pretokenized(separator);
+  else parse_init(chacfgfile);
+
+  ifstream infile(queryfile);
+  while (infile.getline(&input[0], MAX_BUFLEN))
+    if (strlen(&input[0]) > 0) queries.push_back(string(&input[0]));
+  if (basefile != NULL and not rewrite) load_baseline(basefile, baseline);
+
+  for (i=0; i<selected.size(); i++) {
+    const ModeName & mode = modes[selected[i]];
+    if (not run_engine(opts, mode, true, queries, ref) or
+	not run_engine(opts, mode, false, queries, cand)) {
+      cerr << "Error: " << mode.m_name << " run failed." << endl;
+      return EXIT_FAILURE;
+    }
+    diffs += compare_runs(mode, queries, ref, cand);
+    cout << "RUN\t";
+    save_run(cout, mode, "reference", ref);
+    cout << "RUN\t";
+    save_run(cout, mode, "candidate", cand);
+    save_run(runs, mode, "reference", ref);
+    save_run(runs, mode, "candidate", cand);
+    regressions += check_baseline(baseline, mode, "reference", ref, tolerance);
+    regressions += check_baseline(baseline, mode, "candidate", cand, tolerance);
+  }
+
+  if (basefile != NULL and baseline.empty()) {
+    ofstream outfile(basefile);
+    outfile << runs.str();
+    cerr << "Baseline written to " << basefile << endl;
+  }
+  cerr << queries.size() << " queries, " << selected.size() << " modes: ";
+  cerr << diffs << " disagreements, " << regressions << " regressions." << endl;
+
+  return (diffs == 0 and regressions == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -11,23 +11,59 @@
  * ---------------------------------------------------------- */
 
 #include "qadbman.h"
+#include "server.h"
+#include "pipeline.h"
 
 int debug = 0;
 
+// set by SIGHUP, polled between queries
+static volatile sig_atomic_t reload_requested = 0;
+
+static void request_reload (int)
+{
+  reload_requested = 1;
+}
+
+// set by SIGUSR1, prints the timing report
+static volatile sig_atomic_t report_requested = 0;
+
+static void request_report (int)
+{
+  report_requested = 1;
+}
+
+// set by SIGINT/SIGTERM, ends the server mode
+static volatile sig_atomic_t shutdown_requested = 0;
+
+static void request_shutdown (int)
+{
+  shutdown_requested = 1;
+}
+
 int main(int argc, char ** argv)
 {
   QADB *     mydb = NULL;
-  QAPair     qapair;
+  QAHandle * handle = NULL;
+  LoadOptions options;
+  QAResult   result;
+  QAContext  context;
   char       input[MAXINLEN+1];
+  vector<string> queries;
+  vector<string> answers;
+  vector<QAResult> results;
   bool       optimize  = false;
   bool       validate  = false;
   bool       looeval   = false;
   bool       labelmode = false;
   bool       loocvopt  = false;
   bool       cvopt     = false;
+  bool       compress  = false;
+  bool       timing    = false;
   istream *  infile = &cin;
   ostream *  outfile = &cout;
   UINT       iocnt = 0;
+  ULONG      start;
+  UINT       i;
   UINT       heapsize = 100;
   MatchMode  matchmode = MATCH_MAXLEN;
   SimOp      simop = SO_COSINUS;
@@ -44,12 +80,18 @@ int main(int argc, char ** argv)
   const char *  chacfgfile = NULL;
   const char *  morphtable = NULL;
   const char *  stopwlist = NULL;
+  const char *  imagefile = NULL;
+  const char *  sockfile = NULL;
   int   nbestout = 0;
   int   optiter = 0;
+  int   threads = 1;
+  int   parsers = 0;
+  int   cachesize = 0;
+  int   parsecache = 0;
 
   // parse commandline
   if (argc > 1) {
-    while ((opt = getopt(argc, argv, "g:k:b:x:t:c:r:q:a:i:o:m:n:sfdvehpu")) != -1) {
+    while ((opt = getopt(argc, argv, "g:k:b:x:t:c:r:q:a:i:o:m:n:j:l:y:w:S:A:sfdvehpuzT")) != -1) {
       switch(opt) {
       case 'u':
         // unsupervised labeling of queries
@@ -104,6 +146,34 @@ int main(int argc, char ** argv)
       case 'k':
 	heapsize = atoi(optarg);
 	break;
+      case 'j':
+	// number of worker threads
+	threads = atoi(optarg);
+	if (threads < 1) threads = 1;
+	break;
+      case 'A':
+	// number of analysis threads (pipeline mode)
+	parsers = atoi(optarg);
+	if (parsers < 0) parsers = 0;
+	break;
+      case 'l':
+	// size of query result cache
+	cachesize = atoi(optarg);
+	if (cachesize < 0) cachesize = 0;
+	break;
+      case 'w':
+	// compiled database image (out)
+	imagefile = optarg;
+	break;
+      case 'S':
+	// unix socket for server mode
+	sockfile = optarg;
+	break;
+      case 'y':
+	// memory for memoized morphological analysis (MB)
+	parsecache = atoi(optarg);
+	if (parsecache < 0) parsecache = 0;
+	break;
       case 'm':
 	// match mode
 	switch(atoi(optarg)) {
@@ -138,6 +208,14 @@ int main(int argc, char ** argv)
 	// derive and use response prior probability
 	matchmode = MATCH_BAYES;
 	break;
+      case 'z':
+	// compressed postings lists
+	compress = true;
+	break;
+      case 'T':
+	// stage latency report
+	timing = true;
+	break;
       case 's':
 	// LOO self-optimization of Q&A pairs
 	optimize = true;
@@ -167,27 +245,26 @@ int main(int argc, char ** argv)
 
   // init chasen
   parse_init(chacfgfile);
+  parse_cache(static_cast<ULONG>(parsecache) << 20);
 
   // read response sentence and Q&A database
-  if (qadbfile != NULL && respfile != NULL) {
-    mydb = new QADB(string(qadbfile), string(respfile),
-		    heapsize, matchmode, simop);
-  } else {
-    cerr << "Error: cannot read QADB and response sentences." << endl;
-    goto exit_failure;
-  }
-
-  cerr << "QADB: " << mydb->qadb_size() << " Q&A entries loaded." << endl;
-  cerr << "QADB: " << mydb->resp_size() << " distinct responses." << endl;
-  cerr << "QADB: " << mydb->morph_cnt() << " distinct morphemes." << endl;
-
-  // read stopword list (for tf-idf scoring)
-  if (stopwlist != NULL && matchmode == MATCH_TFIDF)
-    mydb->load_stoplist(string(stopwlist));
+  options.m_qadbfile   = qadbfile;
+  options.m_respfile   = respfile;
+  options.m_stopwlist  = stopwlist;
+  options.m_morphtable = morphtable;
+  options.m_heapsize   = heapsize;
+  options.m_matchmode  = matchmode;
+  options.m_simop      = simop;
+  options.m_threads    = threads;
+  options.m_cachesize  = cachesize;
+  options.m_compress   = compress;
+  if ((mydb = load_database(options)) == NULL) goto exit_failure;
 
-  // read morpheme confusion table [experimental]
-  if (morphtable != NULL)
-    mydb->load_morphconftable(string(morphtable));
+  // compile Q&A database for fast startup
+  if (imagefile != NULL) {
+    if (not mydb->compile(string(imagefile))) goto exit_failure;
+    goto exit_success;
+  }
 
   // self-optimization of Q&A database
   if (optimize) {
@@ -262,32 +339,124 @@ int main(int argc, char ** argv)
       goto exit_failure;
     }
   }
-  
+
+  // query modes: the database is replaced in the background on SIGHUP,
+  // queries in flight finish with the database they started with
+  handle = new QAHandle(mydb);
+  mydb = NULL;
+  signal(SIGHUP, request_reload);
+  if (timing) {
+    timing_enable(true);
+    signal(SIGUSR1, request_report);
+  }
+
+  // server mode: answer requests of many clients on a unix socket
+  if (sockfile != NULL) {
+    QAServer server(handle, &options, threads);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, request_shutdown);
+    signal(SIGTERM, request_shutdown);
+    if (not server.listen(sockfile)) goto exit_failure;
+    cerr << "QADB: serving queries on " << sockfile << endl;
+    server.run(&shutdown_requested);
+    cerr << server.requests() << " requests in " << server.batches() << " batches answered." << endl;
+    mydb = handle->acquire();
+    print_cachestats(mydb, cachesize > 0, parsecache > 0);
+    handle->release(mydb);
+    timing_report(cerr);
+    mydb = NULL;
+    goto exit_success;
+  }
+
+  // pipeline mode: reading, morphological analysis (-A threads),
+  // scoring (-j threads) and writing overlap
+  if (parsers > 0) {
+    QAPipeline pipeline(handle, &options, parsers, threads, nbestout);
+
+    iocnt = pipeline.run(infile, outfile);
+    indicator(iocnt,0);
+    cerr << iocnt << " input queries processed." << endl;
+    mydb = handle->acquire();
+    print_cachestats(mydb, cachesize > 0, parsecache > 0);
+    handle->release(mydb);
+    timing_report(cerr);
+    mydb = NULL;
+    goto exit_success;
+  }
+
+  // batch mode: answer blocks of queries with several threads,
+  // results are written in input order
+  if (threads > 1) {
+    while (!infile->eof()) {
+      queries.clear();
+      while (queries.size() < static_cast<UINT>(BATCHLEN * threads) and !infile->eof()) {
+	infile->getline(&input[0], MAXINLEN);
+	if (strlen(&input[0]) == 0) continue;
+	queries.push_back(string(&input[0]));
+      }
+      check_signals(handle, options);
+      mydb = handle->acquire();
+      batch_retrieve(mydb, queries, answers, threads, nbestout);
+      handle->release(mydb);
+      mydb = NULL;
+      for (i=0; i<queries.size(); i++) {
+	*outfile << answers[i] << "\n";
+	iocnt += 1;
+	indicator(iocnt,100);
+      }
+      outfile->flush();
+    }
+    indicator(iocnt,0);
+    cerr << iocnt << " input queries processed." << endl;
+    mydb = handle->acquire();
+    print_cachestats(mydb, cachesize > 0, parsecache > 0);
+    handle->release(mydb);
+    timing_report(cerr);
+    mydb = NULL;
+    goto exit_success;
+  }
+
   // - read queries from standard input
   // - retrieve best matching Q&A pair
   // - write response ID and response message to standard output
   while (!infile->eof()) {
     infile->getline(&input[0], MAXINLEN);
     if (strlen(&input[0]) == 0) continue;
+    check_signals(handle, options);
+    mydb = handle->acquire();
     if (nbestout) {
-      mydb->print_nbestresid(&input[0],nbestout);
+      mydb->retrieve_nbest(&input[0], nbestout, true, context, results);
+      start = timing_start();
+      *outfile << format_nbest(results) << endl;
     } else {
-      qapair = mydb->retrieve(&input[0]);
-      *outfile << qapair.m_resid << " " << qapair.m_score << " " << qapair.m_exact << " " << qapair.m_response << " " << qapair.m_question << " " << input << endl;
+      result = mydb->retrieve(&input[0], context);
+      start = timing_start();
+      *outfile << format_result(mydb, result, &input[0]) << endl;
     }
+    timing_stop(TIME_OUTPUT, start);
+    handle->release(mydb);
+    mydb = NULL;
     iocnt += 1;
     indicator(iocnt,100);
   }
   indicator(iocnt,0);
   cerr << iocnt << " input queries processed." << endl;
+  mydb = handle->acquire();
+  print_cachestats(mydb, cachesize > 0, parsecache > 0);
+  handle->release(mydb);
+  mydb = NULL;
+  timing_report(cerr);
 
  exit_failure:
+  if (handle) delete handle;
   if (mydb) delete mydb;
   if (infile != &cin and infile != NULL) delete infile;
   if (outfile != &cout and outfile != NULL) delete outfile;
   return EXIT_FAILURE;
 
  exit_success:
+  if (handle) delete handle;
   if (mydb) delete mydb;
   if (infile != &cin and infile != NULL) delete infile;
   if (outfile != &cout and outfile != NULL) delete outfile;
@@ -309,9 +478,9 @@ void help (const char * command)
   cerr << "Usage: " << command << endl << endl;
   cerr << "  -m <int:mode>    1:exlen, 2:inlen, [3:maxlen], 4:tf-idf, 5:kbest [EXP]" << endl;
   cerr << "  -b <int:dist>    1:scalar, [2:cosinus] (only for tf-idf)" << endl;
-  cerr << "  -n <int:nbest>   output n-best response identifiers (mode=1,2,3) [EXP]" << endl;
+  cerr << "  -n <int:nbest>   output n-best response identifiers" << endl;
   cerr << "  -r <file:resp>   file with response sentences" << endl;
-  cerr << "  -i <file:qadb>   question and answer database (in)" << endl;
+  cerr << "  -i <file:qadb>   question and answer database or image (in)" << endl;
   cerr << "  -o <file:qadb>   question and answer database (out)" << endl;
   cerr << "  -p <bool>        use response prior (mode=3) [EXP]" << endl;
   cerr << "  -q <file:query>  file with test/vali queries (in)" << endl;
@@ -320,6 +489,15 @@ void help (const char * command)
   cerr << "  -x <file:stop>   list of stopwords (only for tf-idf)" << endl;
   cerr << "  -c <config>      chasenrc configuration file" << endl;
   cerr << "  -k <int:hpsize>  heap size during optimization [100]" << endl;
+  cerr << "  -j <int:threads> number of worker threads for queries [1]" << endl;
+  cerr << "  -A <int:threads> pipeline mode with threads for chasen analysis" << endl;
+  cerr << "  -l <int:size>    cache results of up to size queries [0]" << endl;
+  cerr << "  -y <int:mbyte>   memory for memoized chasen analysis [0]" << endl;
+  cerr << "  -z <bool>        compressed postings lists (less memory)" << endl;
+  cerr << "  -T <bool>        stage latency report at exit (and on SIGUSR1)" << endl;
+  cerr << "  -w <file:image>  compile database into image for -i (out)" << endl;
+  cerr << "                   (loading an image rebuilds the tf-idf matrix)" << endl;
+  cerr << "  -S <file:socket> serve queries on unix socket (Q <query>, N <n> <query>)" << endl;
   cerr << "  -s <bool>        LOO self-optimization of qadb" << endl;
   cerr << "  -d <bool>        CV self-optimization of qadb (heuristic)" << endl;
   cerr << "  -f <bool>        LOO-CV self-optimization of qadb [EXP]" << endl;
@@ -329,5 +507,205 @@ void help (const char * command)
   cerr << "  -u <bool>        unsupervised cross-vali labeling of queries" << endl;
   cerr << "  -g <int:debug>   1:chasen 2:input/output 3:conftab 4:specific" << endl;
   cerr << endl;  
+  cerr << "SIGHUP reloads the -i database while queries are answered." << endl;
+  cerr << endl;
+}
+
+
+// read Q&A database (text or compiled image) and apply the
+// settings that are not part of the database files
+
+QADB * load_database (const LoadOptions & opts)
+{
+  QADB * db = NULL;
+  ifstream test;
+
+  if (opts.m_qadbfile != NULL) test.open(opts.m_qadbfile);
+  if (not test) {
+    cerr << "Error: cannot read QADB and response sentences." << endl;
+    return NULL;
+  }
+  test.close();
+
+  if (QADB::is_image(string(opts.m_qadbfile))) {
+    db = new QADB(string(opts.m_qadbfile), opts.m_heapsize, opts.m_matchmode,
+		  opts.m_simop, opts.m_threads);
+  } else if (opts.m_respfile != NULL) {
+    db = new QADB(string(opts.m_qadbfile), string(opts.m_respfile), opts.m_heapsize,
+		  opts.m_matchmode, opts.m_simop, opts.m_threads);
+  } else {
+    cerr << "Error: cannot read QADB and response sentences." << endl;
+    return NULL;
+  }
+  if (not db->loaded()) {
+    delete db;
+    return NULL;
+  }
+
+  cerr << "QADB: " << db->qadb_size() << " Q&A entries loaded." << endl;
+  cerr << "QADB: " << db->resp_size() << " distinct responses." << endl;
+  cerr << "QADB: " << db->morph_cnt() << " distinct morphemes." << endl;
+
+  // smaller index for many databases per host
+  if (opts.m_compress) {
+    db->set_compressed_index(true);
+    cerr << "QADB: " << db->index_bytes() << " bytes postings index." << endl;
+  }
+
+  // read stopword list (for tf-idf scoring)
+  if (opts.m_stopwlist != NULL && opts.m_matchmode == MATCH_TFIDF)
+    db->load_stoplist(string(opts.m_stopwlist));
+
+  // read morpheme confusion table [experimental]
+  if (opts.m_morphtable != NULL)
+    db->load_morphconftable(string(opts.m_morphtable));
+
+  // cache results of frequent queries
+  db->set_cache(opts.m_cachesize);
+
+  return db;
+}
+
+// loader for QAHandle::reload(), the current database is kept if
+// the new one cannot be read, is damaged or empty
+
+static QADB * reload_database (void * arg)
+{
+  QADB * db = load_database(*static_cast<LoadOptions *>(arg));
+
+  if (db != NULL and db->qadb_size() == 0) {
+    delete db;
+    db = NULL;
+  }
+  if (db == NULL)
+    cerr << "QADB: reload failed, keeping current database." << endl;
+  else
+    cerr << "QADB: reload done." << endl;
+
+  return db;
+}
+
+void check_signals (QAHandle * handle, LoadOptions & opts)
+{
+  if (report_requested) {
+    report_requested = 0;
+    timing_report(cerr);
+  }
+  if (not reload_requested) return;
+  reload_requested = 0;
+  if (handle->reload(reload_database, &opts))
+    cerr << "QADB: reloading database in background." << endl;
+  else
+    cerr << "QADB: reload already in progress." << endl;
+}
+
+// format retrieval result as output line:
+// <resid> <score> <exact> <response> <example question> <query>
+
+string format_result (QADB * mydb, const QAResult & result, const char * query)
+{
+  ostringstream line;
+
+  line << result.m_resid << " " << result.m_score << " " << result.m_exact << " ";
+  if (result.m_index != NO_QAINDEX) {
+    line << mydb->qatext(result.m_index).m_response << " ";
+    line << mydb->qatext(result.m_index).m_question << " ";
+  } else {
+    line << mydb->response(result.m_resid) << " * ";
+  }
+  line << query;
+
+  return line.str();
+}
+
+// report result cache and analysis cache statistics
+
+void print_cachestats (QADB * mydb, bool results, bool analysis)
+{
+  ULONG hits, misses;
+
+  if (results) {
+    hits = mydb->cache_hits();
+    misses = mydb->cache_misses();
+    cerr << "Cache: " << hits << " hits, " << misses << " misses";
+    if (hits + misses > 0) cerr << " (" << (100.0*hits/(hits+misses)) << "% hit rate)";
+    cerr << endl;
+  }
+  if (analysis) {
+    parse_cachestats(hits, misses);
+    cerr << "Analysis Cache: " << hits << " hits, " << misses << " misses";
+    if (hits + misses > 0) cerr << " (" << (100.0*hits/(hits+misses)) << "% hit rate)";
+    cerr << endl;
+  }
+}
+
+// format n-best list as <resid>:<score>/<resid>:<score>/...
+
+string format_nbest (const vector<QAResult> & results)
+{
+  ostringstream line;
+  UINT i;
+
+  for (i=0; i<results.size(); i++) {
+    if (i > 0) line << "/";
+    line << results[i].m_resid << ":" << results[i].m_score;
+  }
+
+  return line.str();
 }
 
+// work shared by the threads of the batch mode
+
+typedef struct {
+  QADB *           m_db;
+  vector<string> * m_queries;
+  vector<string> * m_answers;
+  int              m_nbest;   // n-best output if > 0
+  UINT             m_next;    // next query to be answered
+} BatchJob;
+
+static void * batch_worker (void * arg)
+{
+  BatchJob * job = static_cast<BatchJob *>(arg);
+  QAContext  context;
+  QAResult   result;
+  vector<QAResult> results;
+  UINT       i, n;
+  ULONG      start;
+
+  n = job->m_queries->size();
+  // grab queries one at a time until the block is done
+  while ((i = __sync_fetch_and_add(&job->m_next, 1)) < n) {
+    if (job->m_nbest > 0) {
+      job->m_db->retrieve_nbest((*job->m_queries)[i].c_str(), job->m_nbest,
+				true, context, results);
+      start = timing_start();
+      (*job->m_answers)[i] = format_nbest(results);
+    } else {
+      result = job->m_db->retrieve((*job->m_queries)[i].c_str(), context);
+      start = timing_start();
+      (*job->m_answers)[i] = format_result(job->m_db, result, (*job->m_queries)[i].c_str());
+    }
+    timing_stop(TIME_OUTPUT, start);
+  }
+
+  return NULL;
+}
+
+void batch_retrieve (QADB * mydb, vector<string> & queries,
+		     vector<string> & answers, int threads, int nbest)
+{
+  vector<pthread_t> pool(threads);
+  BatchJob job;
+  int t;
+
+  answers.resize(queries.size());
+  job.m_db      = mydb;
+  job.m_queries = &queries;
+  job.m_answers = &answers;
+  job.m_nbest   = nbest;
+  job.m_next    = 0;
+
+  for (t=0; t<threads; t++) pthread_create(&pool[t], NULL, batch_worker, &job);
+  for (t=0; t<threads; t++) pthread_join(pool[t], NULL);
+}
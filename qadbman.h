@@ -15,11 +15,50 @@
 #define _QADBMAN_H_
 
 #include <getopt.h>
+#include <pthread.h>
+#include <csignal>
+#include <sstream>
 #include "util.h"
 #include "qadb.h"
 
 #define MAXINLEN 4096
+// number of queries per thread read ahead in batch mode
+#define BATCHLEN 256
+// number of queries in flight in pipeline mode
+#define PIPELEN 1024
+// largest n-best list a server client may request
+#define MAXNBEST 1000
 
 void help (const char * command);
 
+// database settings from the command line, kept for reloading
+typedef struct {
+  const char * m_qadbfile;
+  const char * m_respfile;
+  const char * m_stopwlist;
+  const char * m_morphtable;
+  UINT         m_heapsize;
+  MatchMode    m_matchmode;
+  SimOp        m_simop;
+  int          m_threads;
+  int          m_cachesize;
+  bool         m_compress;
+} LoadOptions;
+
+// read Q&A database or image (NULL on failure)
+QADB * load_database (const LoadOptions & opts);
+
+// start a background reload (SIGHUP) or print the
+// timing report (SIGUSR1) if requested
+void check_signals (QAHandle * handle, LoadOptions & opts);
+
+// answer a block of queries with a pool of worker threads
+void batch_retrieve (QADB * mydb, vector<string> & queries,
+		     vector<string> & answers, int threads, int nbest);
+
+// format retrieval result as output line
+string format_result (QADB * mydb, const QAResult & result, const char * query);
+string format_nbest (const vector<QAResult> & results);
+void print_cachestats (QADB * mydb, bool results, bool analysis);
+
 #endif /* _QADBMAN_H_ */
@@ -0,0 +1,120 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Template Class CRing (bounded lock-free queue)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <sched.h>
+#include <unistd.h>
+#include "ring.h"
+
+// back off while waiting on a full or empty queue: spin a little,
+// then give up the processor, then sleep (stages may stall for long)
+
+static inline void ring_backoff (UINT & round)
+{
+  if (round < 16) {
+    round++;
+  } else if (round < 64) {
+    round++;
+    sched_yield();
+  } else {
+    usleep(50);
+  }
+}
+
+template <class DataType>
+CRing <DataType> :: CRing (UINT size)
+{
+  UINT n = 2, i;
+
+  while (n < size) n <<= 1;
+  m_cell = new Cell [n];
+  m_mask = n - 1;
+  for (i=0; i<n; i++) m_cell[i].m_seq = i;
+  m_tail = 0;
+  m_head = 0;
+}
+
+template <class DataType>
+CRing <DataType> :: ~CRing ()
+{
+  delete [] m_cell;
+}
+
+template <class DataType>
+bool CRing <DataType> :: push (const DataType & data)
+{
+  Cell * cell;
+  UINT pos = m_tail, seq;
+  int diff;
+
+  while (true) {
+    cell = &m_cell[pos & m_mask];
+    seq  = cell->m_seq;
+    __sync_synchronize();
+    diff = static_cast<int>(seq - pos);
+    if (diff == 0) {
+      // claim the cell
+      if (__sync_bool_compare_and_swap(&m_tail, pos, pos + 1)) break;
+      pos = m_tail;
+    } else if (diff < 0) {
+      // not yet emptied: full
+      return false;
+    } else {
+      pos = m_tail;
+    }
+  }
+  cell->m_data = data;
+  __sync_synchronize();
+  cell->m_seq = pos + 1;
+
+  return true;
+}
+
+template <class DataType>
+bool CRing <DataType> :: pop (DataType & data)
+{
+  Cell * cell;
+  UINT pos = m_head, seq;
+  int diff;
+
+  while (true) {
+    cell = &m_cell[pos & m_mask];
+    seq  = cell->m_seq;
+    __sync_synchronize();
+    diff = static_cast<int>(seq - (pos + 1));
+    if (diff == 0) {
+      if (__sync_bool_compare_and_swap(&m_head, pos, pos + 1)) break;
+      pos = m_head;
+    } else if (diff < 0) {
+      // not yet filled: empty
+      return false;
+    } else {
+      pos = m_head;
+    }
+  }
+  data = cell->m_data;
+  __sync_synchronize();
+  // free for the producer of the next turn
+  cell->m_seq = pos + m_mask + 1;
+
+  return true;
+}
+
+template <class DataType>
+void CRing <DataType> :: put (const DataType & data)
+{
+  UINT round = 0;
+
+  while (not push(data)) ring_backoff(round);
+}
+
+template <class DataType>
+void CRing <DataType> :: get (DataType & data)
+{
+  UINT round = 0;
+
+  while (not pop(data)) ring_backoff(round);
+}
@@ -0,0 +1,52 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Template Class CRing (bounded lock-free queue)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include "typedefs.h"
+
+// bounded queue for any number of producer and consumer threads,
+// every cell carries a sequence number telling whether it is free
+// for the producer or filled for the consumer of the current turn
+
+template <class DataType>
+class CRing
+{
+public:
+  CRing (UINT size) ;  // rounded up to a power of two
+  virtual ~CRing () ;
+
+  // non-blocking, false if the queue is full or empty
+  bool push (const DataType & data) ;
+  bool pop (DataType & data) ;
+  // wait until there is room or data
+  void put (const DataType & data) ;
+  void get (DataType & data) ;
+
+  UINT size (void) const { return m_mask + 1; }
+
+private:
+  CRing (const CRing &) ;
+  CRing & operator= (const CRing &) ;
+
+  typedef struct {
+    volatile UINT m_seq ;
+    DataType      m_data ;
+  } Cell;
+
+  Cell *        m_cell ;
+  UINT          m_mask ;
+  // producers and consumers on different cache lines
+  char          m_pad1[64] ;
+  volatile UINT m_tail ;  // next cell to fill
+  char          m_pad2[64] ;
+  volatile UINT m_head ;  // next cell to empty
+  char          m_pad3[64] ;
+};
+
+#endif /* _RING_H_ */
@@ -0,0 +1,327 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Query Server (unix domain socket)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include "server.h"
+
+// stop reading requests of a client with this many unsent answer bytes
+#define MAXOUTBUF (1 << 20)
+
+QAServer :: QAServer (QAHandle * handle, LoadOptions * opts, int threads)
+  : m_handle(handle), m_opts(opts), m_listenfd(-1), m_db(NULL), m_next(0),
+    m_served(0), m_batches(0), m_pool(threads > 1 ? threads - 1 : 0),
+    m_contexts(threads > 1 ? threads : 1), m_batchno(0), m_workers(0),
+    m_busy(0), m_quit(false)
+{
+  UINT t;
+
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_start, NULL);
+  pthread_cond_init(&m_finish, NULL);
+  for (t=0; t<m_pool.size(); t++) pthread_create(&m_pool[t], NULL, worker, this);
+}
+
+QAServer :: ~QAServer ()
+{
+  UINT c, t;
+
+  pthread_mutex_lock(&m_mutex);
+  m_quit = true;
+  pthread_cond_broadcast(&m_start);
+  pthread_mutex_unlock(&m_mutex);
+  for (t=0; t<m_pool.size(); t++) pthread_join(m_pool[t], NULL);
+
+  for (c=0; c<m_clients.size(); c++) close(m_clients[c].m_fd);
+  if (m_listenfd >= 0) {
+    close(m_listenfd);
+    unlink(m_path.c_str());
+  }
+  pthread_cond_destroy(&m_finish);
+  pthread_cond_destroy(&m_start);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+bool QAServer :: listen (const char * path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    cerr << "Error: socket path too long: " << path << endl;
+    return false;
+  }
+  if ((m_listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    cerr << "Error: cannot create socket." << endl;
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  // socket file left over by an earlier server
+  unlink(path);
+  if (bind(m_listenfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 or
+      ::listen(m_listenfd, SOMAXCONN) != 0) {
+    cerr << "Error: cannot listen on socket " << path << endl;
+    close(m_listenfd);
+    m_listenfd = -1;
+    return false;
+  }
+  fcntl(m_listenfd, F_SETFL, O_NONBLOCK);
+  m_path = path;
+
+  return true;
+}
+
+void QAServer :: run (const volatile sig_atomic_t * stop)
+{
+  vector<struct pollfd> fds;
+  UINT c;
+
+  while (not *stop) {
+    check_signals(m_handle, *m_opts);
+
+    fds.resize(m_clients.size() + 1);
+    fds[0].fd      = m_listenfd;
+    fds[0].events  = POLLIN;
+    fds[0].revents = 0;
+    for (c=0; c<m_clients.size(); c++) {
+      fds[c+1].fd      = m_clients[c].m_fd;
+      fds[c+1].events  = 0;
+      fds[c+1].revents = 0;
+      // clients that do not take their answers have to wait
+      if (not m_clients[c].m_eof and m_clients[c].m_out.size() < MAXOUTBUF)
+	fds[c+1].events |= POLLIN;
+      if (not m_clients[c].m_out.empty())
+	fds[c+1].events |= POLLOUT;
+    }
+    // wake up now and then for reload requests
+    if (poll(&fds[0], fds.size(), 1000) < 0) {
+      if (errno == EINTR) continue;
+      cerr << "Error: poll on query socket failed." << endl;
+      break;
+    }
+
+    // everything that arrived since the last round is one batch
+    for (c=0; c<m_clients.size(); c++)
+      if ((fds[c+1].events & POLLIN) and (fds[c+1].revents & (POLLIN | POLLHUP | POLLERR)))
+	read_client(c);
+    if (fds[0].revents & POLLIN) accept_clients();
+    if (not m_batch.empty()) answer_batch();
+
+    for (c=0; c<m_clients.size(); c++)
+      if (not m_clients[c].m_out.empty()) write_client(c);
+    drop_clients();
+  }
+}
+
+void QAServer :: accept_clients (void)
+{
+  QAClient client;
+  int fd;
+
+  while ((fd = accept(m_listenfd, NULL, NULL)) >= 0) {
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    client.m_fd  = fd;
+    client.m_eof = false;
+    m_clients.push_back(client);
+  }
+}
+
+void QAServer :: read_client (UINT c)
+{
+  QAClient & client = m_clients[c];
+  QARequest request;
+  char buffer[16384];
+  string::size_type start, pos;
+  ssize_t n;
+
+  n = read(client.m_fd, buffer, sizeof(buffer));
+  if (n < 0) {
+    if (errno == EAGAIN or errno == EINTR) return;
+    // connection is broken, answers cannot be sent
+    client.m_eof = true;
+    client.m_out.clear();
+    return;
+  }
+  if (n == 0) {
+    client.m_eof = true;
+    return;
+  }
+
+  client.m_in.append(buffer, n);
+  start = 0;
+  while ((pos = client.m_in.find('\n', start)) != string::npos) {
+    add_request(c, client.m_in.substr(start, pos - start));
+    start = pos + 1;
+  }
+  client.m_in.erase(0, start);
+
+  if (client.m_in.size() > MAXINLEN) {
+    request.m_client = c;
+    request.m_nbest  = -1;
+    request.m_answer = "E request too long";
+    m_batch.push_back(request);
+    client.m_in.clear();
+    client.m_eof = true;
+  }
+}
+
+// parse request line, bad requests get an error answer
+// in their place so that the order of answers is kept
+
+void QAServer :: add_request (UINT c, const string & line)
+{
+  QARequest request;
+  string::size_type end = line.size();
+  const char * text = line.c_str();
+  char * rest;
+  long nbest;
+
+  if (end > 0 and line[end-1] == '\r') end--;
+  if (end == 0) return;
+
+  request.m_client = c;
+  request.m_nbest  = -1;
+  if (end > 2 and line.compare(0, 2, "Q ") == 0) {
+    request.m_nbest = 0;
+    request.m_query = line.substr(2, end - 2);
+  } else if (end > 2 and line.compare(0, 2, "N ") == 0) {
+    nbest = strtol(text + 2, &rest, 10);
+    if (nbest > 0 and nbest <= MAXNBEST and *rest == ' ' and rest + 1 < text + end) {
+      request.m_nbest = static_cast<int>(nbest);
+      request.m_query = line.substr(rest + 1 - text, text + end - (rest + 1));
+    }
+  }
+  if (request.m_nbest < 0) request.m_answer = "E bad request";
+
+  m_batch.push_back(request);
+}
+
+void QAServer :: answer_batch (void)
+{
+  UINT i;
+
+  m_db   = m_handle->acquire();
+  m_next = 0;
+
+  // single requests are answered right away
+  if (m_pool.empty() or m_batch.size() == 1) {
+    answer(m_contexts.back());
+  } else {
+    pthread_mutex_lock(&m_mutex);
+    m_busy = m_pool.size();
+    m_batchno++;
+    pthread_cond_broadcast(&m_start);
+    pthread_mutex_unlock(&m_mutex);
+
+    answer(m_contexts.back());
+
+    pthread_mutex_lock(&m_mutex);
+    while (m_busy > 0) pthread_cond_wait(&m_finish, &m_mutex);
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  m_handle->release(m_db);
+  m_db = NULL;
+
+  for (i=0; i<m_batch.size(); i++) {
+    m_clients[m_batch[i].m_client].m_out += m_batch[i].m_answer;
+    m_clients[m_batch[i].m_client].m_out += '\n';
+  }
+  m_served  += m_batch.size();
+  m_batches += 1;
+  m_batch.clear();
+}
+
+// answer requests of the current batch until none is left
+
+void QAServer :: answer (QAContext & context)
+{
+  QAResult result;
+  vector<QAResult> results;
+  UINT i, n = m_batch.size();
+  ULONG start;
+
+  while ((i = __sync_fetch_and_add(&m_next, 1)) < n) {
+    QARequest & request = m_batch[i];
+    if (request.m_nbest > 0) {
+      m_db->retrieve_nbest(request.m_query.c_str(), request.m_nbest, true, context, results);
+      start = timing_start();
+      request.m_answer = format_nbest(results);
+      timing_stop(TIME_OUTPUT, start);
+    } else if (request.m_nbest == 0) {
+      result = m_db->retrieve(request.m_query.c_str(), context);
+      start = timing_start();
+      request.m_answer = format_result(m_db, result, request.m_query.c_str());
+      timing_stop(TIME_OUTPUT, start);
+    }
+  }
+}
+
+void * QAServer :: worker (void * arg)
+{
+  QAServer * server = static_cast<QAServer *>(arg);
+  UINT id = __sync_fetch_and_add(&server->m_workers, 1);
+  UINT seen = 0;
+
+  pthread_mutex_lock(&server->m_mutex);
+  while (true) {
+    while (server->m_batchno == seen and not server->m_quit)
+      pthread_cond_wait(&server->m_start, &server->m_mutex);
+    if (server->m_quit) break;
+    seen = server->m_batchno;
+    pthread_mutex_unlock(&server->m_mutex);
+
+    server->answer(server->m_contexts[id]);
+
+    pthread_mutex_lock(&server->m_mutex);
+    if (--server->m_busy == 0) pthread_cond_signal(&server->m_finish);
+  }
+  pthread_mutex_unlock(&server->m_mutex);
+
+  return NULL;
+}
+
+void QAServer :: write_client (UINT c)
+{
+  QAClient & client = m_clients[c];
+  ssize_t n;
+
+  n = write(client.m_fd, client.m_out.data(), client.m_out.size());
+  if (n < 0) {
+    if (errno == EAGAIN or errno == EINTR) return;
+    client.m_eof = true;
+    client.m_out.clear();
+    return;
+  }
+  client.m_out.erase(0, n);
+}
+
+// close connections without further requests or answers
+
+void QAServer :: drop_clients (void)
+{
+  UINT c, k;
+
+  for (c=0, k=0; c<m_clients.size(); c++) {
+    if (m_clients[c].m_eof and m_clients[c].m_out.empty()) {
+      close(m_clients[c].m_fd);
+      continue;
+    }
+    if (k != c) m_clients[k] = m_clients[c];
+    k++;
+  }
+  m_clients.resize(k);
+}
@@ -0,0 +1,91 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Query Server (unix domain socket)
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <string>
+#include <vector>
+#include "qadbman.h"
+
+using namespace std;
+
+// line protocol, one answer line per request line in request order:
+//   Q <query>          ->  <resid> <score> <exact> <response> <question> <query>
+//   N <nbest> <query>  ->  <resid>:<score>/<resid>:<score>/... (nbest <= MAXNBEST)
+//   anything else      ->  E <message>
+// the query has the same syntax as in the stdin mode (n-best hypotheses)
+
+// connected client
+typedef struct {
+  int    m_fd;
+  string m_in;     // received bytes, not yet a complete line
+  string m_out;    // answers not yet sent
+  bool   m_eof;    // no more requests (closed or error)
+} QAClient;
+
+// request of the current batch
+typedef struct {
+  UINT   m_client;  // position in client list
+  int    m_nbest;   // n-best output if > 0, error if < 0
+  string m_query;
+  string m_answer;
+} QARequest;
+
+class QAServer
+{
+public:
+  // serve queries from the database of handle, opts is used for reloading
+  QAServer (QAHandle * handle, LoadOptions * opts, int threads) ;
+  virtual ~QAServer () ;
+
+  // create socket (an old socket file is replaced)
+  bool listen (const char * path) ;
+  // answer requests until *stop is set, all requests that arrived
+  // together are answered as one batch by the worker threads
+  void run (const volatile sig_atomic_t * stop) ;
+
+  ULONG requests (void) const { return m_served; }
+  ULONG batches (void) const { return m_batches; }
+
+private:
+  QAServer (const QAServer &) ;
+  QAServer & operator= (const QAServer &) ;
+
+  void accept_clients (void) ;
+  void read_client (UINT c) ;
+  void add_request (UINT c, const string & line) ;
+  void answer_batch (void) ;
+  void answer (QAContext & context) ;
+  void write_client (UINT c) ;
+  void drop_clients (void) ;
+  static void * worker (void * arg) ;
+
+  QAHandle *         m_handle ;
+  LoadOptions *      m_opts ;
+  int                m_listenfd ;
+  string             m_path ;
+  vector<QAClient>   m_clients ;
+  vector<QARequest>  m_batch ;
+  QADB *             m_db ;        // database of the current batch
+  UINT               m_next ;      // next request to be answered
+  ULONG              m_served ;
+  ULONG              m_batches ;
+
+  // worker pool, started once and woken up for each batch
+  vector<pthread_t>  m_pool ;
+  vector<QAContext>  m_contexts ;  // one per worker, last one for the server thread
+  pthread_mutex_t    m_mutex ;
+  pthread_cond_t     m_start ;
+  pthread_cond_t     m_finish ;
+  UINT               m_batchno ;
+  UINT               m_workers ;   // workers started (id of next worker)
+  UINT               m_busy ;      // workers still on the batch
+  bool               m_quit ;
+};
+
+#endif /* _SERVER_H_ */
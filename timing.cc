@@ -0,0 +1,212 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Latency Histograms of the Query Stages
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#include <pthread.h>
+#include <time.h>
+#include <iomanip>
+#include <sstream>
+#include "timing.h"
+
+#define HIST_SUBBITS 5
+#define HIST_SUB     (1 << HIST_SUBBITS)
+// values below 2*HIST_SUB are counted exactly, then HIST_SUB buckets per power of two
+#define HIST_BUCKETS ((8 * sizeof(ULONG) - HIST_SUBBITS + 1) * HIST_SUB)
+
+CHistogram :: CHistogram ()
+  : m_count(HIST_BUCKETS, 0), m_total(0), m_max(0)
+{
+}
+
+UINT CHistogram :: bucket (ULONG value)
+{
+  UINT shift;
+
+  if (value < 2 * HIST_SUB) return value;
+  shift = 8 * sizeof(ULONG) - 1 - __builtin_clzl(value) - HIST_SUBBITS;
+  return (shift + 1) * HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+// largest value counted in bucket
+
+ULONG CHistogram :: upper (UINT bucket)
+{
+  UINT shift;
+  ULONG sub;
+
+  if (bucket < 2 * HIST_SUB) return bucket;
+  shift = bucket / HIST_SUB - 1;
+  sub   = bucket % HIST_SUB + HIST_SUB;
+  return ((sub + 1) << shift) - 1;
+}
+
+void CHistogram :: add (ULONG value)
+{
+  m_count[bucket(value)] += 1;
+  m_total += 1;
+  if (value > m_max) m_max = value;
+}
+
+void CHistogram :: merge (const CHistogram & other)
+{
+  UINT i;
+
+  for (i=0; i<m_count.size(); i++) m_count[i] += other.m_count[i];
+  m_total += other.m_total;
+  if (other.m_max > m_max) m_max = other.m_max;
+}
+
+void CHistogram :: clear (void)
+{
+  m_count.assign(m_count.size(), 0);
+  m_total = 0;
+  m_max = 0;
+}
+
+ULONG CHistogram :: percentile (double p) const
+{
+  ULONG rank, sum = 0;
+  UINT i;
+
+  if (m_total == 0) return 0;
+  rank = static_cast<ULONG>(p * m_total + 0.999999);
+  if (rank < 1) rank = 1;
+  for (i=0; i<m_count.size(); i++) {
+    sum += m_count[i];
+    if (sum >= rank) break;
+  }
+  return (i < m_count.size() and upper(i) < m_max) ? upper(i) : m_max;
+}
+
+// histograms of one thread, threads which have finished
+// leave theirs to the next new thread
+
+typedef struct {
+  CHistogram m_stage[TIME_STAGES];
+} ThreadTimes;
+
+static bool            timing_on = false;
+static ULONG           timing_begin = 0;
+static pthread_key_t   timing_key;
+static pthread_once_t  timing_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timing_mutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<ThreadTimes *> timing_threads;
+static vector<ThreadTimes *> timing_spare;
+
+static void timing_release (void * arg)
+{
+  pthread_mutex_lock(&timing_mutex);
+  timing_spare.push_back(static_cast<ThreadTimes *>(arg));
+  pthread_mutex_unlock(&timing_mutex);
+}
+
+static void timing_init (void)
+{
+  pthread_key_create(&timing_key, timing_release);
+}
+
+// the mutex is only taken the first time a thread records
+
+static ThreadTimes * timing_thread (void)
+{
+  ThreadTimes * times = static_cast<ThreadTimes *>(pthread_getspecific(timing_key));
+
+  if (times == NULL) {
+    pthread_mutex_lock(&timing_mutex);
+    if (timing_spare.empty()) {
+      times = new ThreadTimes;
+      timing_threads.push_back(times);
+    } else {
+      times = timing_spare.back();
+      timing_spare.pop_back();
+    }
+    pthread_mutex_unlock(&timing_mutex);
+    pthread_setspecific(timing_key, times);
+  }
+  return times;
+}
+
+static ULONG timing_clock (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<ULONG>(ts.tv_sec) * 1000000000UL + ts.tv_nsec;
+}
+
+void timing_enable(bool on)
+{
+  pthread_once(&timing_once, timing_init);
+  timing_begin = timing_clock();
+  timing_on = on;
+}
+
+bool timing_enabled(void)
+{
+  return timing_on;
+}
+
+ULONG timing_start(void)
+{
+  return timing_on ? timing_clock() : 0;
+}
+
+ULONG timing_since(ULONG start)
+{
+  return (start != 0) ? timing_clock() - start : 0;
+}
+
+void timing_add(TimingStage stage, ULONG nanosec)
+{
+  if (timing_on) timing_thread()->m_stage[stage].add(nanosec);
+}
+
+ULONG timing_stop(TimingStage stage, ULONG start)
+{
+  ULONG elapsed = timing_since(start);
+
+  if (start != 0) timing_add(stage, elapsed);
+  return elapsed;
+}
+
+// the histograms are read while the threads go on recording,
+// so a report on demand may miss the latest queries
+
+void timing_report(ostream & out)
+{
+  static const char * names[TIME_STAGES] = {
+    "parse", "codes", "accumulate", "score", "output"
+  };
+  static const double quantiles[3] = { 0.50, 0.95, 0.99 };
+  CHistogram total[TIME_STAGES];
+  ostringstream line;
+  double seconds;
+  ULONG queries;
+  UINT i, s, q;
+
+  if (not timing_on) return;
+  pthread_mutex_lock(&timing_mutex);
+  for (i=0; i<timing_threads.size(); i++)
+    for (s=0; s<TIME_STAGES; s++) total[s].merge(timing_threads[i]->m_stage[s]);
+  pthread_mutex_unlock(&timing_mutex);
+
+  seconds = (timing_clock() - timing_begin) / 1e9;
+  queries = total[TIME_SCORE].count();
+  line << "Timing: " << queries << " queries in " << seconds << " s";
+  if (seconds > 0) line << " (" << (queries / seconds) << " queries/s)";
+  line << endl;
+
+  line << "Timing: " << left << setw(11) << "stage" << right << setw(9) << "count";
+  line << setw(10) << "p50" << setw(10) << "p95" << setw(10) << "p99" << setw(10) << "max";
+  line << " (usec)" << endl;
+  line << fixed << setprecision(1);
+  for (s=0; s<TIME_STAGES; s++) {
+    line << "Timing: " << left << setw(11) << names[s] << right << setw(9) << total[s].count();
+    for (q=0; q<3; q++) line << setw(10) << total[s].percentile(quantiles[q]) / 1000.0;
+    line << setw(10) << total[s].max() / 1000.0 << endl;
+  }
+  out << line.str();
+}
@@ -0,0 +1,69 @@
+/* ------------------------------------------------------------ -*-c++-*- *\
+   Latency Histograms of the Query Stages
+
+   Copyright (c) 2006-2007 Nara Institute of Science and Technology
+   All Rights Reserved.
+\* ---------------------------------------------------------------------- */
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include <iostream>
+#include <vector>
+#include "typedefs.h"
+
+using namespace std;
+
+// stages of a query, one sample per query and stage
+typedef enum {
+  TIME_PARSE,       // chasen analysis (or analysis cache)
+  TIME_CODES,       // validate_sentence and morpheme codes
+  TIME_ACCUMULATE,  // postings lists walk
+  TIME_SCORE,       // rest of the retrieval (cache, exact match, scores, ranking)
+  TIME_OUTPUT,      // formatting the answer (and writing it if on the same thread)
+  TIME_STAGES
+} TimingStage;
+
+// log-linear histogram of nanosecond values (HDR style):
+// 32 buckets per power of two, relative error below 1/32
+
+class CHistogram
+{
+public:
+  CHistogram () ;
+  virtual ~CHistogram () {}
+
+  void add (ULONG value) ;
+  void merge (const CHistogram & other) ;
+  void clear (void) ;
+
+  ULONG count (void) const { return m_total; }
+  ULONG max (void) const { return m_max; }
+  // smallest value that at least fraction p of the values do not exceed
+  ULONG percentile (double p) const ;
+
+private:
+  static UINT  bucket (ULONG value) ;
+  static ULONG upper (UINT bucket) ;
+
+  vector<ULONG> m_count ;
+  ULONG         m_total ;
+  ULONG         m_max ;
+};
+
+// stage timers are off until enabled, every thread records into
+// its own histograms, which are only summed up for a report
+
+void  timing_enable(bool on);
+bool  timing_enabled(void);
+// clock for a stage (0 if timing is off)
+ULONG timing_start(void);
+// nanoseconds since start (0 if start is 0)
+ULONG timing_since(ULONG start);
+void  timing_add(TimingStage stage, ULONG nanosec);
+// record and return the time since start
+ULONG timing_stop(TimingStage stage, ULONG start);
+// percentiles of all threads and queries per second since enabled
+void  timing_report(ostream & out);
+
+#endif /* _TIMING_H_ */
@@ -56,7 +56,7 @@ UINT minimum_edit_distance(const vector<UINT> a, const vector<UINT> b)
   UINT    i,j,d,v,w;
 
   // allocate memory
-  matrix = (UINT **) malloc (sizeof(UINT) * (n+1));
+  matrix = (UINT **) malloc (sizeof(UINT *) * (n+1));
   for (i=0;i<=n;i++) {
     matrix[i] = (UINT *) calloc ((m+1), sizeof(UINT));
   }
@@ -111,8 +111,8 @@ vector<AlignElement> alignment(const vector<UINT> a, const vector<UINT> b)
   vector<AlignElement> al;
 
   // allocate memory
-  matrix = (UINT **) malloc (sizeof(UINT) * (n+1));
-  path = (EAlignType **) malloc(sizeof(EAlignType) * (n+1));
+  matrix = (UINT **) malloc (sizeof(UINT *) * (n+1));
+  path = (EAlignType **) malloc(sizeof(EAlignType *) * (n+1));
   for (i=0;i<=n;i++) {
     matrix[i] = (UINT *) calloc ((m+1), sizeof(UINT));
     path[i] = (EAlignType *) calloc((m+1), sizeof(EAlignType));
@@ -209,8 +209,8 @@ vector<AlignElement> alignment(const vector<string> a, const vector<string> b)
   vector<AlignElement> al;
 
   // allocate memory
-  matrix = (UINT **) malloc(sizeof(UINT) * (n+1));
-  path = (EAlignType **) malloc(sizeof(EAlignType) * (n+1));
+  matrix = (UINT **) malloc(sizeof(UINT *) * (n+1));
+  path = (EAlignType **) malloc(sizeof(EAlignType *) * (n+1));
   for (i=0;i<=n;i++) {
     matrix[i] = (UINT *) calloc((m+1), sizeof(UINT));
     path[i] = (EAlignType *) calloc((m+1), sizeof(EAlignType));